@@ -18,12 +18,19 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <istream>
+#include <sstream>
 #include <vector>
 
+#include "bitboard.h"
+#include "movegen.h"
 #include "position.h"
+#include "thread.h"
+#include "uci.h"
 
 using namespace std;
 
@@ -154,3 +161,186 @@ vector<string> setup_bench(const Position& current, istream& is) {
 
   return list;
 }
+
+
+namespace {
+
+// time_calls() runs f(pos, i) over all the positions for the given number of
+// passes, where f returns the number of calls it made, and reports the average
+// cost of a call.
+template<typename F>
+void time_calls(const char* name, vector<Position>& positions, int passes, F f) {
+
+  uint64_t calls = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (int p = 0; p < passes; ++p)
+      for (size_t i = 0; i < positions.size(); ++i)
+          calls += f(positions[i], i);
+
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  cerr << std::left << std::setw(18) << name << std::right
+       << std::setw(13) << calls
+       << std::setw(12) << std::fixed << std::setprecision(2) << (calls ? ns / calls : 0.0)
+       << std::setw(12) << (ns > 0 ? 1000.0 * calls / ns : 0.0) << endl;
+}
+
+// GenTimer calls generate<Type>() in the positions where it is allowed: in
+// check for EVASIONS, not in check for the other types but LEGAL.
+template<GenType Type>
+struct GenTimer {
+  uint64_t& checksum;
+
+  uint64_t operator()(Position& pos, size_t) const {
+    ExtMove buffer[MAX_MOVES];
+
+    if (Type != LEGAL && !!pos.checkers() != (Type == EVASIONS))
+        return 0;
+
+    checksum += generate<Type>(pos, buffer) - buffer;
+    return 1;
+  }
+};
+
+} // namespace
+
+
+/// move_bench() times the move generation primitives in isolation over the
+/// bench positions and all their children: each generate<> type, the pair
+/// do_move/undo_move, see_ge, gives_check and the slider attack lookup. In
+/// PEXT builds the lookup is timed also with magic multiplication indexing,
+/// so that both paths can be compared with a single binary. The parameter
+/// is the number of passes over the positions.
+///
+/// movebench -> 200 passes
+/// movebench 1000 -> 1000 passes
+
+void move_bench(istream& is) {
+
+  string token;
+  int passes;
+  if (!(is >> passes))
+      passes = 200;
+  passes = std::max(passes, 1);
+
+  // Collect the root positions as FEN strings, applying any trailing moves
+  vector<string> fens;
+  StateInfo rootSt[64];
+
+  for (const string& def : Defaults)
+  {
+      if (def.find("setoption") != string::npos)
+          continue;
+
+      size_t movesPos = def.find(" moves ");
+      Position pos;
+      StateInfo* st = rootSt;
+      pos.set(def.substr(0, movesPos), false, st, Threads.main());
+
+      if (movesPos != string::npos)
+      {
+          istringstream ms(def.substr(movesPos + 7));
+          while (ms >> token)
+              pos.do_move(UCI::to_move(pos, token), *++st);
+      }
+
+      fens.push_back(pos.fen());
+
+      for (const auto& m : MoveList<LEGAL>(pos))
+      {
+          StateInfo childSt;
+          pos.do_move(m, childSt);
+          fens.push_back(pos.fen());
+          pos.undo_move(m);
+      }
+  }
+
+  vector<Position> positions(fens.size());
+  vector<StateInfo> states(fens.size());
+  vector<vector<Move>> legalMoves(fens.size());
+  size_t inCheck = 0, moveCount = 0;
+
+  for (size_t i = 0; i < fens.size(); ++i)
+  {
+      positions[i].set(fens[i], false, &states[i], Threads.main());
+      inCheck += !!positions[i].checkers();
+
+      for (const auto& m : MoveList<LEGAL>(positions[i]))
+          legalMoves[i].push_back(m);
+
+      moveCount += legalMoves[i].size();
+  }
+
+  uint64_t checksum = 0;
+
+  cerr << "\n==========================="
+       << "\nPositions       : " << positions.size() << " (" << inCheck << " in check)"
+       << "\nLegal moves     : " << moveCount
+       << "\nPasses          : " << passes
+       << "\n\nPrimitive              Calls     ns/call    Mcalls/s" << endl;
+
+  time_calls("gen CAPTURES",     positions, passes, GenTimer<CAPTURES>{checksum});
+  time_calls("gen QUIETS",       positions, passes, GenTimer<QUIETS>{checksum});
+  time_calls("gen QUIET_CHECKS", positions, passes, GenTimer<QUIET_CHECKS>{checksum});
+  time_calls("gen NON_EVASIONS", positions, passes, GenTimer<NON_EVASIONS>{checksum});
+  time_calls("gen EVASIONS",     positions, passes, GenTimer<EVASIONS>{checksum});
+  time_calls("gen LEGAL",        positions, passes, GenTimer<LEGAL>{checksum});
+
+  time_calls("do/undo_move", positions, passes, [&](Position& pos, size_t i) -> uint64_t {
+      StateInfo st;
+      for (Move m : legalMoves[i])
+      {
+          pos.do_move(m, st);
+          pos.undo_move(m);
+      }
+      return legalMoves[i].size();
+  });
+
+  time_calls("see_ge", positions, passes, [&](Position& pos, size_t i) -> uint64_t {
+      for (Move m : legalMoves[i])
+          checksum += pos.see_ge(m);
+      return legalMoves[i].size();
+  });
+
+  time_calls("gives_check", positions, passes, [&](Position& pos, size_t i) -> uint64_t {
+      for (Move m : legalMoves[i])
+          checksum += pos.gives_check(m);
+      return legalMoves[i].size();
+  });
+
+  // Slider attacks from every square with the position occupancy, a rook
+  // and a bishop lookup per call.
+  const char* lookup = HasPext ? "attacks (pext)" : "attacks (magic)";
+  Bitboard lookupSum[] = { 0, 0 };
+
+  time_calls(lookup, positions, passes, [&](Position& pos, size_t) -> uint64_t {
+      Bitboard occupied = pos.pieces();
+      for (Square s = SQ_A1; s <= SQ_H8; ++s)
+          lookupSum[0] += attacks_bb<ROOK>(s, occupied) ^ attacks_bb<BISHOP>(s, occupied);
+      return SQUARE_NB;
+  });
+
+  if (HasPext)
+  {
+      vector<Bitboard> rookTable(Bitboards::RookTableSize), bishopTable(Bitboards::BishopTableSize);
+      Magic rookMagics[SQUARE_NB], bishopMagics[SQUARE_NB];
+
+      Bitboards::init_magic_index(rookMagics, rookTable.data(), bishopMagics, bishopTable.data());
+
+      time_calls("attacks (magic)", positions, passes, [&](Position& pos, size_t) -> uint64_t {
+          Bitboard occupied = pos.pieces();
+          for (Square s = SQ_A1; s <= SQ_H8; ++s)
+              lookupSum[1] +=  rookMagics[s].attacks[rookMagics[s].magic_index(occupied)]
+                             ^ bishopMagics[s].attacks[bishopMagics[s].magic_index(occupied)];
+          return SQUARE_NB;
+      });
+
+      if (lookupSum[0] != lookupSum[1])
+          cerr << "Attacks mismatch between pext and magic lookup" << endl;
+  }
+
+  checksum += lookupSum[0];
+
+  cerr << "\nChecksum        : " << checksum << endl;
+}
@@ -19,10 +19,12 @@
 */
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <numeric>
 #include <vector>
 
 #include "bitboard.h"
+#include "kpkbitbase.h"
 #include "types.h"
 
 namespace {
@@ -30,8 +32,11 @@ namespace {
   // There are 24 possible pawn squares: the first 4 files and ranks from 2 to 7
   constexpr unsigned MAX_INDEX = 2*24*64*64; // stm * psq * wksq * bksq = 196608
 
-  // Each uint32_t stores results of 32 positions, one per bit
-  uint32_t KPKBitbase[MAX_INDEX / 32];
+  // Each uint32_t stores results of 32 positions, one per bit. The table is
+  // embedded at compile time, see kpkbitbase.h.
+  constexpr const uint32_t* KPKBitbase = Bitbases::KPKData;
+
+  static_assert(sizeof(Bitbases::KPKData) * 8 == MAX_INDEX, "KPKData does not match MAX_INDEX");
 
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
@@ -53,6 +58,10 @@ namespace {
     WIN     = 4
   };
 
+#ifndef NDEBUG
+
+  // The retrograde analysis that generated KPKData, run only in debug builds
+
   Result& operator|=(Result& r, Result v) { return r = Result(r | v); }
 
   struct KPKPosition {
@@ -69,6 +78,10 @@ namespace {
     Result result;
   };
 
+  void generate(uint32_t bitbase[]);
+
+#endif
+
 } // namespace
 
 
@@ -81,30 +94,55 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color us) {
 }
 
 
-void Bitbases::init() {
+/// Bitbases::init() does nothing in release builds, as the bitbase is embedded.
+/// Debug builds check it against the retrograde analysis, and print the table
+/// for kpkbitbase.h if they differ.
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+void Bitbases::init() {
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+#ifndef NDEBUG
+  std::vector<uint32_t> kpk(MAX_INDEX / 32);
+  generate(kpk.data());
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+  if (!std::equal(kpk.begin(), kpk.end(), KPKBitbase))
+  {
+      for (unsigned i = 0; i < kpk.size(); ++i)
+          printf("%s0x%08X,%s", i % 8 ? " " : "  ", kpk[i], i % 8 == 7 ? "\n" : "");
 
-  // Map 32 results into one KPKBitbase[] entry
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
+      assert(false);
+  }
+#endif
 }
 
 
 namespace {
 
+#ifndef NDEBUG
+
+  // generate() computes the KPK bitbase by retrograde analysis
+
+  void generate(uint32_t bitbase[]) {
+
+    std::vector<KPKPosition> db(MAX_INDEX);
+    unsigned idx, repeat = 1;
+
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        db[idx] = KPKPosition(idx);
+
+    // Iterate through the positions until none of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+
+    // Map 32 results into one bitbase[] entry
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        if (db[idx] == WIN)
+            bitbase[idx / 32] |= 1 << (idx & 0x1F);
+  }
+
+
   KPKPosition::KPKPosition(unsigned idx) {
 
     ksq[WHITE] = Square((idx >>  0) & 0x3F);
@@ -176,4 +214,6 @@ namespace {
     return result = r & Good  ? Good  : r & UNKNOWN ? UNKNOWN : Bad;
   }
 
+#endif // #ifndef NDEBUG
+
 } // namespace
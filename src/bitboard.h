@@ -23,6 +23,10 @@
 
 #include <string>
 
+#if defined(USE_AVX2)
+#  include <immintrin.h>
+#endif
+
 #include "types.h"
 
 namespace Bitbases {
@@ -90,6 +94,12 @@ struct Magic {
     if (HasPext)
         return unsigned(pext(occupied, mask));
 
+    return magic_index(occupied);
+  }
+
+  // The magic multiplication alone, also used to compare with pext in PEXT builds
+  unsigned magic_index(Bitboard occupied) const {
+
     if (Is64Bit)
         return unsigned(((occupied & mask) * magic) >> shift);
 
@@ -102,6 +112,16 @@ struct Magic {
 extern Magic RookMagics[SQUARE_NB];
 extern Magic BishopMagics[SQUARE_NB];
 
+namespace Bitboards {
+
+constexpr int RookTableSize   = 0x19000; // Entries of the rook attacks table
+constexpr int BishopTableSize = 0x1480;  // Entries of the bishop attacks table
+
+void init_magic_index(Magic rookMagics[], Bitboard rookTable[],
+                      Magic bishopMagics[], Bitboard bishopTable[]);
+
+}
+
 
 /// Overloads of bitwise operators between a Bitboard and a Square for testing
 /// whether a given bit is set in a bitboard, and for setting and clearing bits.
@@ -275,10 +295,125 @@ inline Bitboard attacks_bb(PieceType pt, Square s, Bitboard occupied) {
 }
 
 
+#if defined(USE_AVX2)
+
+/// fill_attacks() computes the same attacks as attacks_bb() without any table,
+/// with Kogge-Stone occluded fills. Each 64 bit lane runs the fill along one
+/// ray direction, a left or a right shift, the other one shifts by 64 and
+/// yields 0. Rook and bishop use the 4 lanes of an AVX2 register, the queen
+/// uses the 8 lanes of an AVX-512 register if available, or both of them.
+
+namespace SIMD {
+
+  // Steps of the rook and bishop rays: N, E, S, W and NE, NW, SE, SW
+  constexpr uint64_t LeftShift[][4]  = { {  8,  1, 64, 64 }, {  9,  7, 64, 64 } };
+  constexpr uint64_t RightShift[][4] = { { 64, 64,  8,  1 }, { 64, 64,  7,  9 } };
+
+  // Squares that can be reached by a step of each ray without wrapping
+  constexpr uint64_t NotA = ~FileABB, NotH = ~FileHBB, All = ~0ULL;
+  constexpr uint64_t StepMask[][4] = { { All, NotA, All, NotH }, { NotA, NotH, NotA, NotH } };
+
+  inline __m256i load(const uint64_t v[4]) {
+    return _mm256_loadu_si256((const __m256i*)v);
+  }
+
+  inline __m256i shift(__m256i x, __m256i l, __m256i r) {
+    return _mm256_or_si256(_mm256_sllv_epi64(x, l), _mm256_srlv_epi64(x, r));
+  }
+
+  inline Bitboard fill4(int bishop, Square s, Bitboard occupied) {
+
+    const __m256i l1 = load(LeftShift[bishop]), r1 = load(RightShift[bishop]);
+    const __m256i l2 = _mm256_add_epi64(l1, l1), r2 = _mm256_add_epi64(r1, r1);
+    const __m256i l4 = _mm256_add_epi64(l2, l2), r4 = _mm256_add_epi64(r2, r2);
+    const __m256i mask = load(StepMask[bishop]);
+
+    __m256i gen = _mm256_set1_epi64x(int64_t(Bitboard(1) << s));
+    __m256i pro = _mm256_and_si256(_mm256_set1_epi64x(int64_t(~occupied)), mask);
+
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift(gen, l1, r1)));
+    pro = _mm256_and_si256(pro, shift(pro, l1, r1));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift(gen, l2, r2)));
+    pro = _mm256_and_si256(pro, shift(pro, l2, r2));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift(gen, l4, r4)));
+    gen = _mm256_and_si256(shift(gen, l1, r1), mask);
+
+    __m128i b = _mm_or_si128(_mm256_castsi256_si128(gen), _mm256_extracti128_si256(gen, 1));
+    return Bitboard(_mm_cvtsi128_si64(b) | _mm_extract_epi64(b, 1));
+  }
+
+#if defined(__AVX512F__)
+
+  // The zero masking forms with all the lanes selected are the plain shifts.
+  // GCC 12 warns that the pass-through of _mm512_sllv_epi64() and of the other
+  // intrinsics with an undefined one may be used uninitialized once inlined.
+  inline __m512i shift(__m512i x, __m512i l, __m512i r) {
+    return _mm512_or_si512(_mm512_maskz_sllv_epi64(0xFF, x, l), _mm512_maskz_srlv_epi64(0xFF, x, r));
+  }
+
+  inline Bitboard fill8(Square s, Bitboard occupied) {
+
+    const __m512i l1 = _mm512_loadu_si512(LeftShift),  r1 = _mm512_loadu_si512(RightShift);
+    const __m512i l2 = _mm512_add_epi64(l1, l1), r2 = _mm512_add_epi64(r1, r1);
+    const __m512i l4 = _mm512_add_epi64(l2, l2), r4 = _mm512_add_epi64(r2, r2);
+    const __m512i mask = _mm512_loadu_si512(StepMask);
+
+    __m512i gen = _mm512_set1_epi64(int64_t(Bitboard(1) << s));
+    __m512i pro = _mm512_and_si512(_mm512_set1_epi64(int64_t(~occupied)), mask);
+
+    gen = _mm512_or_si512(gen, _mm512_and_si512(pro, shift(gen, l1, r1)));
+    pro = _mm512_and_si512(pro, shift(pro, l1, r1));
+    gen = _mm512_or_si512(gen, _mm512_and_si512(pro, shift(gen, l2, r2)));
+    pro = _mm512_and_si512(pro, shift(pro, l2, r2));
+    gen = _mm512_or_si512(gen, _mm512_and_si512(pro, shift(gen, l4, r4)));
+    gen = _mm512_and_si512(shift(gen, l1, r1), mask);
+
+    __m256i h = _mm256_or_si256(_mm512_maskz_extracti64x4_epi64(0xFF, gen, 0),
+                                _mm512_maskz_extracti64x4_epi64(0xFF, gen, 1));
+    __m128i b = _mm_or_si128(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+    return Bitboard(_mm_cvtsi128_si64(b) | _mm_extract_epi64(b, 1));
+  }
+
+#endif
+
+} // namespace SIMD
+
+template<PieceType Pt>
+inline Bitboard fill_attacks(Square s, Bitboard occupied) {
+
+  static_assert(Pt == BISHOP || Pt == ROOK || Pt == QUEEN, "Slider expected");
+
+#if defined(__AVX512F__)
+  if (Pt == QUEEN)
+      return SIMD::fill8(s, occupied);
+#endif
+
+  return  (Pt != ROOK   ? SIMD::fill4(1, s, occupied) : 0)
+        | (Pt != BISHOP ? SIMD::fill4(0, s, occupied) : 0);
+}
+
+#endif
+
+
 /// popcount() counts the number of non-zero bits in a bitboard
 
 inline int popcount(Bitboard b) {
 
+#if defined(USE_DISPATCH)
+
+  if (HasPopCnt)
+  {
+#  if defined(_MSC_VER)
+      return (int)__popcnt64(b);
+#  else
+      Bitboard r;
+      __asm__("popcntq %1, %0" : "=r" (r) : "r" (b));
+      return (int)r;
+#  endif
+  }
+
+#endif
+
 #ifndef USE_POPCNT
 
   extern uint8_t PopCnt16[1 << 16];
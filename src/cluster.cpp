@@ -0,0 +1,674 @@
+/*
+  SugaR, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  SugaR is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SugaR is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "cluster.h"
+#include "misc.h"
+#include "position.h"
+#include "search.h"
+#include "tt.h"
+#include "uci.h"
+
+namespace Cluster {
+
+bool Sharing = false;
+
+} // namespace Cluster
+
+#if defined(_WIN32)
+
+namespace Cluster {
+
+void init(const std::string& workers, const std::string&) {
+
+  if (!workers.empty() && workers != "<empty>")
+      sync_cout << "info string Cluster mode is not available on Windows" << sync_endl;
+}
+
+bool listen(const std::string&, const std::string&) {
+
+  sync_cout << "info string Cluster mode is not available on Windows" << sync_endl;
+  return false;
+}
+
+void disconnect() {}
+bool accepts(const std::string&) { return true; }
+void set_rank(int) {}
+size_t rank() { return 0; }
+void send(const std::string&) {}
+void go(const Position&) {}
+void finish_search() {}
+Move vote(const Position&, Move best, Value, Depth) { return best; }
+uint64_t nodes_searched() { return 0; }
+void share(Key, Value, Bound, Depth, Move, Value) {}
+void flush() {}
+void receive(std::istream&) {}
+
+} // namespace Cluster
+
+#else
+
+namespace {
+
+  constexpr TimePoint FlushInterval = 100; // Milliseconds between two batches of TT entries
+  constexpr size_t MaxSecret = 256;        // Longest secret of a cluster
+
+  // A worker as seen by the master, with the last result of its search as read
+  // from its "info" lines.
+  struct Worker {
+    explicit Worker(int f) : fd(f) {}
+
+    int fd;
+    std::thread reader;
+    bool searching = false;
+    int depth = 0;
+    Value score = VALUE_NONE;
+    std::string move;
+    uint64_t nodes = 0;
+  };
+
+  struct Result {
+    std::string move;
+    Value score;
+    int depth;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::mutex ResultsMutex, SendMutex, SharedMutex, StoreMutex;
+  std::condition_variable SearchFinished;
+  std::vector<Result> Results; // Results of the workers at the end of the search
+  bool Active = false;         // True while the workers search for the master, set under StoreMutex
+  bool Serving = false;        // True on a worker once its master is connected
+  size_t NodeRank = 0;
+  std::string Shared;          // TT entries waiting to be sent
+  TimePoint LastFlush = 0;
+
+
+  // write_line() sends a line to a worker. Errors are ignored: a lost worker
+  // simply stops contributing.
+  void write_line(int fd, const std::string& line) {
+
+    std::string s = line + "\n";
+
+    for (size_t sent = 0; sent < s.size(); )
+    {
+        ssize_t n = ::send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        sent += size_t(n);
+    }
+  }
+
+
+  // store() saves in the TT the entries read from the stream, as written by
+  // Cluster::share(). Records out of the range of a TT entry are dropped: a
+  // bound beyond BOUND_EXACT would overwrite the generation of the entry.
+  void store(std::istream& is) {
+
+    Key key;
+    int m, v, ev, d, b;
+    bool found;
+
+    while (is >> std::hex >> key >> std::dec >> m >> v >> ev >> d >> b)
+        if (   b >= BOUND_UPPER && b <= BOUND_EXACT
+            && d >= DEPTH_NONE  && d <  DEPTH_MAX
+            && m >= 0 && m <= 0xFFFF
+            && abs(v)  <  VALUE_INFINITE
+            && abs(ev) <= VALUE_NONE)
+            TT.probe(key, found)->save(key, Value(v), Bound(b), Depth(d), Move(m), Value(ev));
+  }
+
+
+  // parse_line() reads a line of output of a worker. The results of the main
+  // line are kept for the vote, TT entries are stored and relayed to the other
+  // workers, and "bestmove" ends the search of the worker.
+  void parse_line(Worker* w, const std::string& line) {
+
+    std::istringstream is(line);
+    std::string token;
+
+    is >> token;
+
+    if (token == "bestmove")
+    {
+        std::lock_guard<std::mutex> lk(ResultsMutex);
+        w->searching = false;
+        SearchFinished.notify_all();
+        return;
+    }
+
+    if (token != "info" || !(is >> token))
+        return;
+
+    if (token == "string")
+    {
+        std::string records;
+
+        if (   !(is >> token) || token != "cluster"
+            || !(is >> token) || token != "tt"
+            || !std::getline(is, records))
+            return;
+
+        // Late entries are dropped: once finish_search() has returned, the TT
+        // may be cleared or resized.
+        {
+            std::lock_guard<std::mutex> lk(StoreMutex);
+            if (!Active)
+                return;
+
+            std::istringstream rs(records);
+            store(rs);
+        }
+
+        std::lock_guard<std::mutex> lk(SendMutex);
+        for (auto& o : Workers)
+            if (o.get() != w)
+                write_line(o->fd, "ttput" + records);
+        return;
+    }
+
+    int depth = 0, v;
+    Value score = VALUE_NONE;
+    uint64_t nodes = 0;
+    bool first = false, bound = false;
+    std::string move;
+
+    do {
+        if (token == "depth")
+            is >> depth;
+        else if (token == "multipv")
+            first = (is >> v) && v == 1;
+        else if (token == "score" && (is >> token >> v))
+            score = Value(  token == "cp" ? v * PawnValueEg / 100
+                          : v > 0         ? VALUE_MATE - 2 * v + 1 : -VALUE_MATE - 2 * v);
+        else if (token == "lowerbound" || token == "upperbound")
+            bound = true;
+        else if (token == "nodes")
+            is >> nodes;
+        else if (token == "pv")
+        {
+            is >> move;
+            break;
+        }
+    } while (is >> token);
+
+    std::lock_guard<std::mutex> lk(ResultsMutex);
+
+    if (nodes)
+        w->nodes = nodes;
+
+    if (first && !bound && !move.empty() && score != VALUE_NONE)
+        w->depth = depth, w->score = score, w->move = move;
+  }
+
+
+  // read_worker() is the loop of the thread reading the output of a worker,
+  // until the connection is closed.
+  void read_worker(Worker* w) {
+
+    std::string buf;
+    char chunk[4096];
+    ssize_t n;
+
+    while ((n = recv(w->fd, chunk, sizeof(chunk), 0)) > 0)
+    {
+        buf.append(chunk, size_t(n));
+
+        for (size_t end; (end = buf.find('\n')) != std::string::npos; buf.erase(0, end + 1))
+            parse_line(w, buf.substr(0, end));
+    }
+
+    std::lock_guard<std::mutex> lk(ResultsMutex);
+    w->searching = false;
+    SearchFinished.notify_all();
+  }
+
+
+  // connect_to() opens a TCP connection to "host:port", returning -1 on failure
+  int connect_to(const std::string& addr) {
+
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos)
+        return -1;
+
+    std::string host = addr.substr(0, colon), port = addr.substr(colon + 1);
+    addrinfo hints = {}, *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res))
+        return -1;
+
+    int fd = -1;
+    for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen))
+            close(fd), fd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    int one = 1;
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+  }
+
+
+  // authenticate() tells if the first line sent by a master is the secret. It
+  // waits for it at most 10 seconds and reads it a byte at a time, so that what
+  // follows is left to the standard input of the worker. The comparison takes
+  // the same time whatever the position of the first wrong byte.
+  bool authenticate(int fd, const std::string& secret) {
+
+    timeval tv = { 10, 0 }, none = { 0, 0 };
+    std::string line;
+    char c = 0;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    while (line.size() <= MaxSecret && recv(fd, &c, 1, 0) == 1 && c != '\n')
+        line += c;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+
+    if (c != '\n' || line.size() != secret.size())
+        return false;
+
+    int diff = 0;
+    for (size_t i = 0; i < line.size(); ++i)
+        diff |= line[i] ^ secret[i];
+
+    return !diff;
+  }
+
+} // namespace
+
+
+namespace Cluster {
+
+/// Cluster::init() connects the master to the workers given as a comma
+/// separated list of "host:port", dropping any previous ones. Each worker is
+/// sent the secret, then told its rank, from 1 on.
+
+void init(const std::string& workers, const std::string& secret) {
+
+  disconnect();
+
+  if (workers.empty() || workers == "<empty>")
+      return;
+
+  if (secret.empty() || secret == "<empty>")
+  {
+      sync_cout << "info string Set ClusterSecret before ClusterWorkers" << sync_endl;
+      return;
+  }
+
+  std::istringstream is(workers);
+  std::string addr;
+
+  while (std::getline(is, addr, ','))
+  {
+      int fd = connect_to(addr);
+
+      if (fd < 0)
+          sync_cout << "info string Cannot connect to cluster worker " << addr << sync_endl;
+      else
+      {
+          write_line(fd, secret);
+          Workers.emplace_back(new Worker(fd));
+      }
+  }
+
+  // Start the readers only once the list is complete, since they walk it
+  for (size_t i = 0; i < Workers.size(); ++i)
+  {
+      write_line(Workers[i]->fd, "clusterrank " + std::to_string(i + 1));
+      Workers[i]->reader = std::thread(read_worker, Workers[i].get());
+  }
+
+  Sharing = !Workers.empty();
+
+  sync_cout << "info string Cluster of " << Workers.size() + 1 << " nodes" << sync_endl;
+}
+
+
+/// Cluster::disconnect() closes the connections to the workers, which then quit
+
+void disconnect() {
+
+  for (auto& w : Workers)
+  {
+      shutdown(w->fd, SHUT_RDWR);
+      w->reader.join();
+      close(w->fd);
+  }
+
+  Workers.clear();
+  Results.clear();
+  Active = false; // The readers are joined
+  Sharing = NodeRank > 0;
+}
+
+
+/// Cluster::listen() waits for the master on "[host:]port", by default on the
+/// loopback interface, then makes the connection the standard input and output
+/// of the process. The first line sent by the master must be the secret, else
+/// the connection is closed and the next one awaited. Returns false if no
+/// connection could be made.
+
+bool listen(const std::string& where, const std::string& secret) {
+
+  if (secret.empty() || secret.size() > MaxSecret)
+  {
+      sync_cout << "info string A cluster worker needs a secret of at most "
+                << MaxSecret << " characters" << sync_endl;
+      return false;
+  }
+
+  size_t colon = where.rfind(':');
+  std::string host = colon != std::string::npos ? where.substr(0, colon) : "127.0.0.1";
+  std::string port = where.substr(colon != std::string::npos ? colon + 1 : 0);
+  addrinfo hints = {}, *res;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+  int s = -1, one = 1;
+
+  if (!getaddrinfo(host.c_str(), port.c_str(), &hints, &res))
+  {
+      for (addrinfo* ai = res; ai && s < 0; ai = ai->ai_next)
+      {
+          s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+          if (   s >= 0
+              && (   setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+                  || bind(s, ai->ai_addr, ai->ai_addrlen)
+                  || ::listen(s, 1)))
+              close(s), s = -1;
+      }
+
+      freeaddrinfo(res);
+  }
+
+  if (s < 0)
+  {
+      sync_cout << "info string Cannot listen on " << host << ":" << port << sync_endl;
+      return false;
+  }
+
+  sync_cout << "info string Waiting for the cluster master on " << host << ":" << port << sync_endl;
+
+  int fd;
+
+  while ((fd = accept(s, nullptr, nullptr)) >= 0)
+  {
+      if (authenticate(fd, secret))
+          break;
+
+      sync_cout << "info string Rejected a cluster master with a wrong secret" << sync_endl;
+      close(fd);
+  }
+
+  close(s);
+
+  if (fd < 0)
+      return false;
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  dup2(fd, 0);
+  dup2(fd, 1);
+  close(fd);
+  std::cin.clear();
+  Serving = true;
+  return true;
+}
+
+
+/// Cluster::accepts() tells if a command may be run. A worker runs only those
+/// its master sends, so that the connection is not a console of the machine.
+
+bool accepts(const std::string& cmd) {
+
+  static const std::set<std::string> MasterCommands = {
+      "clusterrank", "go", "position", "quit", "stop", "ttput", "ucinewgame" };
+
+  return !Serving || MasterCommands.count(cmd);
+}
+
+
+/// Cluster::set_rank() is called on a worker when the master connects, see the
+/// "clusterrank" command. NodeRank 0 is the master.
+
+void set_rank(int r) {
+
+  NodeRank = size_t(std::max(r, 0));
+  Sharing = NodeRank > 0 || !Workers.empty();
+}
+
+size_t rank() { return NodeRank; }
+
+
+/// Cluster::send() forwards a UCI command to the workers
+
+void send(const std::string& cmd) {
+
+  std::lock_guard<std::mutex> lk(SendMutex);
+
+  for (auto& w : Workers)
+      write_line(w->fd, cmd);
+}
+
+
+/// Cluster::go() starts the workers on the position last sent to them, as an
+/// infinite analysis with the 'searchmoves' of the search of the master. They
+/// are stopped by Cluster::finish_search().
+
+void go(const Position& pos) {
+
+  if (Workers.empty())
+      return;
+
+  std::string cmd = "go infinite";
+
+  if (!Search::Limits.searchmoves.empty())
+  {
+      cmd += " searchmoves";
+      for (Move m : Search::Limits.searchmoves)
+          cmd += " " + UCI::move(m, pos.is_chess960());
+  }
+
+  {
+      std::lock_guard<std::mutex> lk(ResultsMutex);
+
+      for (auto& w : Workers)
+      {
+          w->searching = true;
+          w->depth = 0;
+          w->score = VALUE_NONE;
+          w->move.clear();
+          w->nodes = 0;
+      }
+  }
+
+  {
+      std::lock_guard<std::mutex> lk(StoreMutex);
+      Active = true;
+  }
+
+  LastFlush = now();
+  send(cmd);
+}
+
+
+/// Cluster::finish_search() stops the workers and waits, up to a second, for
+/// their best moves. The last results of their main lines are then kept for
+/// Cluster::vote(). The readers store no more TT entries once it returns.
+
+void finish_search() {
+
+  Results.clear();
+
+  if (!Active)
+      return;
+
+  {
+      std::lock_guard<std::mutex> lk(StoreMutex);
+      Active = false;
+  }
+
+  flush();
+  send("stop");
+
+  std::unique_lock<std::mutex> lk(ResultsMutex);
+
+  SearchFinished.wait_for(lk, std::chrono::seconds(1), []{
+      return std::none_of(Workers.begin(), Workers.end(),
+                          [](const std::unique_ptr<Worker>& w) { return w->searching; });
+  });
+
+  for (auto& w : Workers)
+      if (!w->move.empty())
+          Results.push_back({ w->move, w->score, w->depth });
+}
+
+
+/// Cluster::vote() returns the best move of the cluster, voted as between the
+/// threads in MainThread::search() from the best move of the master and the
+/// results of the workers. Moves that are not legal in the position, in case a
+/// worker lost track, are left out.
+
+Move vote(const Position& pos, Move best, Value score, Depth depth) {
+
+  std::vector<Result> results = { { std::string(), score, int(depth / ONE_PLY) } };
+  std::vector<Move> moves = { best };
+
+  for (Result r : Results)
+  {
+      Move m = UCI::to_move(pos, r.move);
+      if (m != MOVE_NONE)
+          results.push_back(r), moves.push_back(m);
+  }
+
+  std::map<Move, int> votes;
+  Value minScore = score;
+
+  for (const Result& r : results)
+      minScore = std::min(minScore, r.score);
+
+  for (size_t i = 0; i < results.size(); ++i)
+      votes[moves[i]] += int(results[i].score - minScore) + results[i].depth;
+
+  for (Move m : moves)
+      if (votes[m] > votes[best])
+          best = m;
+
+  return best;
+}
+
+
+/// Cluster::nodes_searched() returns the nodes last reported by the workers
+
+uint64_t nodes_searched() {
+
+  std::lock_guard<std::mutex> lk(ResultsMutex);
+
+  uint64_t nodes = 0;
+  for (auto& w : Workers)
+      nodes += w->nodes;
+
+  return nodes;
+}
+
+
+/// Cluster::share() queues a TT entry to be sent with the next batch. At the
+/// depths it is called for, entries are few enough for a text format.
+
+void share(Key key, Value v, Bound b, Depth d, Move m, Value ev) {
+
+  std::ostringstream ss;
+  ss << ' ' << std::hex << key << std::dec << ' ' << int(m) << ' ' << int(v)
+     << ' ' << int(ev) << ' ' << int(d) << ' ' << int(b);
+
+  std::lock_guard<std::mutex> lk(SharedMutex);
+  Shared += ss.str();
+}
+
+
+/// Cluster::flush() sends the queued TT entries, at most every FlushInterval.
+/// It is called by MainThread::check_time(). Workers write them to their
+/// output, where the master reads them, and the master sends its own to the
+/// workers with the "ttput" command.
+
+void flush() {
+
+  if (!Sharing || now() - LastFlush < FlushInterval)
+      return;
+
+  LastFlush = now();
+  std::string records;
+
+  {
+      std::lock_guard<std::mutex> lk(SharedMutex);
+      records.swap(Shared);
+  }
+
+  if (records.empty())
+      return;
+
+  if (NodeRank > 0)
+      sync_cout << "info string cluster tt" << records << sync_endl;
+  else
+      send("ttput" + records);
+}
+
+
+/// Cluster::receive() stores the TT entries of a "ttput" command
+
+void receive(std::istream& is) { store(is); }
+
+} // namespace Cluster
+
+#endif
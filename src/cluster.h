@@ -0,0 +1,81 @@
+/*
+  SugaR, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  SugaR is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SugaR is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLUSTER_H_INCLUDED
+#define CLUSTER_H_INCLUDED
+
+#include <istream>
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+/// Cluster mode spreads a search over several SugaR processes connected by TCP,
+/// usually on identical machines. Each worker is started with the command
+/// 'clusterworker [host:]port secret', which waits for a connection on the
+/// given address, by default on the loopback interface, and then reads the
+/// commands of the master from it and writes its output to it. The first line
+/// of a connection must be the secret, and only the commands the master sends
+/// are run, so the connection cannot be used as a console. The process driven
+/// by the GUI, the master, connects to the workers listed in the ClusterWorkers
+/// option with the secret of the ClusterSecret option, which is to be set
+/// first, and forwards them the positions and searches, so that they search as
+/// infinite analyses next to its own threads:
+///
+/// - The threads of worker r continue the lazy SMP depth schedule of those of
+///   the master, as if they were its helpers r * Threads to (r + 1) * Threads
+///   - 1, see skip_block() in search.cpp.
+/// - TT entries of at least ShareDepth are sent in batches from the workers to
+///   the master, which stores them and relays them to the other workers along
+///   with its own.
+/// - When the master stops, it stops the workers and the best move is voted
+///   among the master and the last results of the workers, like between the
+///   threads of a process.
+/// - The nodes reported by the master are those of the whole cluster.
+///
+/// Cluster mode is not available on Windows.
+
+namespace Cluster {
+
+constexpr Depth ShareDepth = 10 * ONE_PLY; // Least depth of the TT entries sent
+
+extern bool Sharing; // True if the TT entries of the searches are to be sent
+
+void init(const std::string& workers, const std::string& secret);
+void disconnect();
+bool listen(const std::string& where, const std::string& secret);
+bool accepts(const std::string& cmd);
+void set_rank(int r);
+size_t rank();
+
+void send(const std::string& cmd);
+void go(const Position& pos);
+void finish_search();
+Move vote(const Position& pos, Move best, Value score, Depth depth);
+uint64_t nodes_searched();
+
+void share(Key key, Value v, Bound b, Depth d, Move m, Value ev);
+void flush();
+void receive(std::istream& is);
+
+} // namespace Cluster
+
+#endif // #ifndef CLUSTER_H_INCLUDED
@@ -21,7 +21,7 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <map>
+#include <cassert>
 #include <memory>
 #include <string>
 #include <type_traits>
@@ -90,56 +90,70 @@ struct Endgame : public EndgameBase<T> {
 };
 
 
-/// The Endgames class stores the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
-/// endgame function by calling its virtual operator().
+/// The Endgames namespace stores the pointers to endgame evaluation and scaling
+/// base objects in two open-addressed hash tables indexed by material key. They
+/// are filled once by init() and then shared, read-only, by all the threads. We
+/// use polymorphism to invoke the actual endgame function by calling its virtual
+/// operator().
 
-class Endgames {
+namespace Endgames {
 
   template<typename T> using Ptr = std::unique_ptr<EndgameBase<T>>;
-  template<typename T> using Map = std::map<Key, Ptr<T>>;
 
+  // Table is a hash table with linear probing. An empty slot has a zero key,
+  // so that a miss, the common case, usually ends at the first slot.
   template<typename T>
-  Map<T>& map() {
-    return std::get<std::is_same<T, ScaleFactor>::value>(maps);
+  struct Table {
+
+    static constexpr size_t Size = 64; // Power of 2, 4 times the 16 entries
+
+    void insert(Key key, EndgameBase<T>* eg) {
+
+      assert(key);
+
+      size_t i = key & (Size - 1);
+      while (keys[i] && keys[i] != key)
+          i = (i + 1) & (Size - 1);
+
+      keys[i] = key;
+      funcs[i] = Ptr<T>(eg);
+    }
+
+    const EndgameBase<T>* probe(Key key) const {
+
+      for (size_t i = key & (Size - 1); keys[i]; i = (i + 1) & (Size - 1))
+          if (keys[i] == key)
+              return funcs[i].get();
+
+      return nullptr;
+    }
+
+    Key keys[Size] = {};
+    Ptr<T> funcs[Size];
+  };
+
+  extern std::pair<Table<Value>, Table<ScaleFactor>> tables;
+
+  template<typename T>
+  Table<T>& table() {
+    return std::get<std::is_same<T, ScaleFactor>::value>(tables);
   }
 
   template<EndgameCode E, typename T = eg_type<E>>
   void add(const std::string& code) {
 
     StateInfo st;
-    map<T>()[Position().set(code, WHITE, &st).material_key()] = Ptr<T>(new Endgame<E>(WHITE));
-    map<T>()[Position().set(code, BLACK, &st).material_key()] = Ptr<T>(new Endgame<E>(BLACK));
+    table<T>().insert(Position().set(code, WHITE, &st).material_key(), new Endgame<E>(WHITE));
+    table<T>().insert(Position().set(code, BLACK, &st).material_key(), new Endgame<E>(BLACK));
   }
 
-  std::pair<Map<Value>, Map<ScaleFactor>> maps;
-
-public:
-  Endgames() {
-
-    add<KPK>("KPK");
-    add<KNNK>("KNNK");
-    add<KBNK>("KBNK");
-    add<KRKP>("KRKP");
-    add<KRKB>("KRKB");
-    add<KRKN>("KRKN");
-    add<KQKP>("KQKP");
-    add<KQKR>("KQKR");
-
-    add<KNPK>("KNPK");
-    add<KNPKB>("KNPKB");
-    add<KRPKR>("KRPKR");
-    add<KRPKB>("KRPKB");
-    add<KBPKB>("KBPKB");
-    add<KBPKN>("KBPKN");
-    add<KBPPKB>("KBPPKB");
-    add<KRPPKRP>("KRPPKRP");
-  }
+  void init();
 
   template<typename T>
   const EndgameBase<T>* probe(Key key) {
-    return map<T>().count(key) ? map<T>()[key].get() : nullptr;
+    return table<T>().probe(key);
   }
-};
+
+} // namespace Endgames
 
 #endif // #ifndef ENDGAME_H_INCLUDED
@@ -39,6 +39,7 @@ namespace Trace {
   };
 
   Score scores[TERM_NB][COLOR_NB];
+  int fillMismatches; // SIMD slider attacks that differ from the tables
 
   double to_cp(Value v) { return double(v) / PawnValueEg; }
 
@@ -190,6 +191,7 @@ namespace {
   private:
     template<Color Us> void initialize();
     template<Color Us, PieceType Pt> Score pieces();
+    template<PieceType Pt> Bitboard slider_attacks(Square s, Bitboard occupied) const;
     template<Color Us> Score king() const;
     template<Color Us> Score threats() const;
     template<Color Us> Score passed() const;
@@ -282,6 +284,33 @@ namespace {
   }
 
 
+  // Evaluation::slider_attacks() returns the attacks of a bishop, rook or queen
+  // with the given occupancy. SIMD builds compute them with Kogge-Stone fills,
+  // checked against the attack tables when tracing. With ATTACK_MAPS the map
+  // kept by the position is used unless one of the x-rayed pieces is in it.
+  template<Tracing T> template<PieceType Pt>
+  Bitboard Evaluation<T>::slider_attacks(Square s, Bitboard occupied) const {
+
+#if defined(ATTACK_MAPS)
+    Bitboard att = pos.attacks_of(s);
+
+    if (!(att & pos.pieces() & ~occupied))
+        return att;
+#endif
+
+#if defined(USE_AVX2)
+    Bitboard b = fill_attacks<Pt>(s, occupied);
+
+    if (T && b != attacks_bb(Pt, s, occupied))
+        ++fillMismatches;
+
+    return b;
+#else
+    return attacks_bb(Pt, s, occupied);
+#endif
+  }
+
+
   // Evaluation::pieces() scores pieces of a given color and type
   template<Tracing T> template<Color Us, PieceType Pt>
   Score Evaluation<T>::pieces() {
@@ -301,8 +330,9 @@ namespace {
     while ((s = *pl++) != SQ_NONE)
     {
         // Find attacked squares, including x-ray attacks for bishops and rooks
-        b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(QUEEN))
-          : Pt ==   ROOK ? attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
+        b = Pt == BISHOP ? slider_attacks<BISHOP>(s, pos.pieces() ^ pos.pieces(QUEEN))
+          : Pt ==   ROOK ? slider_attacks<  ROOK>(s, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
+          : Pt ==  QUEEN ? slider_attacks< QUEEN>(s, pos.pieces())
                          : pos.attacks_from<Pt>(s);
 
         if (pos.blockers_for_king(Us) & s)
@@ -802,6 +832,8 @@ namespace {
 
     assert(!pos.checkers());
 
+    STATS_INC(pos.this_thread(), STAT_EVAL);
+
     // Probe the material hash table
     me = Material::probe(pos);
 
@@ -822,7 +854,10 @@ namespace {
     // Early exit if score is high
     Value v = (mg_value(score) + eg_value(score)) / 2;
     if (abs(v) > LazyThreshold)
+    {
+       STATS_INC(pos.this_thread(), STAT_EVAL_LAZY);
        return pos.side_to_move() == WHITE ? v : -v;
+    }
 
     // Main evaluation begins here
 
@@ -872,7 +907,25 @@ namespace {
 /// evaluation of the position from the point of view of the side to move.
 
 Value Eval::evaluate(const Position& pos) {
-  return Evaluation<NO_TRACE>(pos).value();
+
+  Thread* thisThread = pos.this_thread();
+
+  if (!thisThread->useEvalCache)
+      return Evaluation<NO_TRACE>(pos).value();
+
+  CacheEntry* e = thisThread->evalCache[pos.key()];
+
+  STATS_INC(thisThread, STAT_EVAL_CACHE_PROBE);
+
+  if (e->key == pos.key() && e->contempt == thisThread->contempt)
+  {
+      STATS_INC(thisThread, STAT_EVAL_CACHE_HIT);
+      return e->value;
+  }
+
+  e->key = pos.key();
+  e->contempt = thisThread->contempt;
+  return e->value = Evaluation<NO_TRACE>(pos).value();
 }
 
 
@@ -883,6 +936,7 @@ Value Eval::evaluate(const Position& pos) {
 std::string Eval::trace(const Position& pos) {
 
   std::memset(scores, 0, sizeof(scores));
+  fillMismatches = 0;
 
   pos.this_thread()->contempt = SCORE_ZERO; // Reset any dynamic contempt
 
@@ -913,5 +967,9 @@ std::string Eval::trace(const Position& pos) {
 
   ss << "\nTotal evaluation: " << to_cp(v) << " (white side)\n";
 
+#if defined(USE_AVX2)
+  ss << "SIMD slider attacks: " << (fillMismatches ? std::to_string(fillMismatches) + " mismatches" : "verified") << "\n";
+#endif
+
   return ss.str();
 }
@@ -23,6 +23,7 @@
 
 #include <string>
 
+#include "misc.h"
 #include "types.h"
 
 class Position;
@@ -31,6 +32,18 @@ namespace Eval {
 
 constexpr Value Tempo = Value(20); // Must be visible to search
 
+/// Eval::CacheEntry stores the result of evaluate() for a position. The value
+/// includes the contempt of the thread, so an entry is valid only for the same
+/// contempt setting. The cache is used only if EvalCacheSize is not 0.
+
+struct CacheEntry {
+  Key key;
+  Score contempt;
+  Value value;
+};
+
+typedef HashTable<CacheEntry, 256> Cache;
+
 std::string trace(const Position& pos);
 
 Value evaluate(const Position& pos);
@@ -21,6 +21,8 @@
 #include <iostream>
 
 #include "bitboard.h"
+#include "cluster.h"
+#include "endgame.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -38,23 +40,28 @@ int main(int argc, char* argv[]) {
   setvbuf( stdout, NULL, _IONBF, 0 );
   std::cout.setf( std::ios::unitbuf ); // For C++
   std::cin.setf( std::ios::unitbuf ); // For C++
+  CPU::init();
   std::cout << engine_info() << std::endl;
 
-  UCI::init(Options);
-  Tune::init();
-  PSQT::init();
-  Bitboards::init();
-  Position::init();
-  Bitbases::init();
-  Search::init();
-  Pawns::init();
-  polybook.init(Options["BookFile"]);
-  Tablebases::init(Options["SyzygyPath"]); // After Bitboards are set
-  Threads.set(Options["Threads"]);
-  Search::clear(); // After threads are up
+  // Each step is timed for the 'startup' command
+  Startup::timed("UCI::init",        []{ UCI::init(Options); });
+  Startup::timed("Tune::init",       Tune::init);
+  Startup::timed("PSQT::init",       PSQT::init);
+  Startup::timed("Bitboards::init",  Bitboards::init);
+  Startup::timed("Position::init",   Position::init);
+  Startup::timed("Bitbases::init",   Bitbases::init);
+  Startup::timed("Endgames::init",   Endgames::init);
+  Startup::timed("Search::init",     Search::init);
+  Startup::timed("Pawns::init",      Pawns::init);
+  Startup::timed("polybook.init",    []{ polybook.init(Options["BookFile"]); });
+  Startup::timed("Tablebases::init", []{ Tablebases::init(Options["SyzygyPath"]); }); // After Bitboards are set
+  Startup::timed("Threads.set",      []{ Threads.set(Options["Threads"]); });
+  Startup::timed("Search::clear",    Search::clear); // After threads are up
 
   UCI::loop(argc, argv);
 
+  Cluster::disconnect();
+  polybook.save_learning();
   Threads.set(0);
   return 0;
 }
@@ -0,0 +1,410 @@
+/*
+  SugaR, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  SugaR is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SugaR is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "cluster.h"
+#include "match.h"
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "tune.h"
+#include "uci.h"
+
+using namespace std;
+
+extern vector<string> setup_bench(const Position&, istream&);
+
+namespace {
+
+  // Adjudication: a game is won once both engines agree on a score of at least
+  // WinScore for WinPlies plies in a row, and drawn from DrawPly on once they
+  // agree on a score of at most DrawScore for DrawPlies plies, or at MaxPlies.
+  constexpr Value WinScore  = Value(1000);
+  constexpr Value DrawScore = Value(10);
+  constexpr int   WinPlies  = 4;
+  constexpr int   DrawPly   = 80;
+  constexpr int   DrawPlies = 8;
+  constexpr int   MaxPlies  = 400;
+
+  typedef vector<pair<string, string>> Params; // Option names and values
+
+  struct Settings {
+    int games = 100, slots = 1;
+    string hash = "16";
+    Search::LimitsType limits;
+    vector<string> openings;
+    Params params[2]; // Set 'a' and set 'b'
+  };
+
+
+  // apply() sets the parameters of one of the sets. They are read at once, also
+  // when the tuning session was set up with UPDATE_ON_LAST().
+
+  void apply(const Params& params) {
+
+    for (const auto& p : params)
+        Options[p.first] = p.second;
+
+    Tune::read_options();
+  }
+
+
+  // play_game() plays a game from the given FEN with set 'a' as 'first' and
+  // returns its result for set 'a': 1 for a win, 0 for a draw, -1 for a loss.
+  // The game is replayed from the opening before each move, as for the UCI
+  // 'position' command, so that the search sees the whole game history.
+
+  int play_game(const Settings& s, const string& fen, Color first) {
+
+    Position pos;
+    vector<Move> moves;
+    TimePoint clock[COLOR_NB] = { s.limits.time[WHITE], s.limits.time[BLACK] };
+    int winner = 0, winPlies = 0, drawPlies = 0;
+
+    Search::clear();
+
+    while (true)
+    {
+        StateListPtr states(new std::deque<StateInfo>(1));
+        pos.set(fen, false, &states->back(), Threads.main());
+
+        for (Move m : moves)
+        {
+            states->emplace_back();
+            pos.do_move(m, states->back());
+        }
+
+        Color us = pos.side_to_move();
+        int sign = us == first ? 1 : -1;
+
+        if (!MoveList<LEGAL>(pos).size())
+            return pos.checkers() ? -sign : 0;
+
+        if (pos.is_draw(0) || int(moves.size()) >= MaxPlies)
+            return 0;
+
+        apply(s.params[us != first]);
+
+        Search::LimitsType limits = s.limits;
+        limits.time[WHITE] = clock[WHITE];
+        limits.time[BLACK] = clock[BLACK];
+        limits.startTime = now();
+        limits.silent = true;
+
+        Threads.start_thinking(pos, states, limits);
+        Threads.main()->wait_for_search_finished();
+
+        if (limits.time[us])
+        {
+            clock[us] -= now() - limits.startTime;
+            if (clock[us] < 0)
+                return -sign;
+
+            clock[us] += limits.inc[us];
+        }
+
+        const Search::RootMove& rm = Threads.main()->bestThread->rootMoves[0];
+        moves.push_back(rm.pv[0]);
+
+        if (rm.score == -VALUE_INFINITE) // A book move
+            continue;
+
+        int side = rm.score * sign > 0 ? 1 : -1;
+
+        winPlies = abs(rm.score) < WinScore ? 0 : side == winner ? winPlies + 1 : 1;
+        winner = side;
+        drawPlies = int(moves.size()) >= DrawPly && abs(rm.score) <= DrawScore ? drawPlies + 1 : 0;
+
+        if (winPlies >= WinPlies)
+            return winner;
+
+        if (drawPlies >= DrawPlies)
+            return 0;
+    }
+  }
+
+
+  // play_slot() plays the games slot, slot + slots, ... of the match and passes
+  // their results to 'report'. Game 2n and 2n + 1 play the n-th opening, with
+  // set 'a' as white and as black.
+
+  template<typename F>
+  void play_slot(const Settings& s, int slot, F report) {
+
+    for (int g = slot; g < s.games; g += s.slots)
+        report(play_game(s, s.openings[g / 2 % s.openings.size()], g % 2 ? BLACK : WHITE));
+  }
+
+
+  // elo() converts a score fraction to an Elo difference
+
+  double elo(double score) {
+
+    score = std::max(0.001, std::min(0.999, score));
+    return -400 * std::log10(1 / score - 1);
+  }
+
+
+  // result() formats the result of the games played so far. The error is the
+  // 95% confidence margin of the Elo estimate.
+
+  string result(const int count[3], bool last) {
+
+    int n = count[0] + count[1] + count[2];
+    double score = (count[2] + count[1] / 2.0) / std::max(n, 1);
+    double var = (  count[2] * (1 - score) * (1 - score)
+                  + count[1] * (0.5 - score) * (0.5 - score)
+                  + count[0] * score * score) / std::max(n, 1);
+    double margin = 1.96 * std::sqrt(var / std::max(n, 1));
+
+    stringstream ss;
+    ss << (last ? "tunematch result" : "info string tunematch")
+       << " games " << n << " wins " << count[2] << " draws " << count[1]
+       << " losses " << count[0] << std::fixed << std::setprecision(1)
+       << " elo " << elo(score)
+       << " error " << (elo(score + margin) - elo(score - margin)) / 2;
+
+    return ss.str();
+  }
+
+
+  // parse() reads the settings of the match. It returns false, after telling
+  // why, if they cannot be used.
+
+  bool parse(istream& args, Settings& s) {
+
+    string token, openings = "default";
+    int set = -1;
+
+    while (args >> token)
+        if (token == "a" || token == "b")
+            set = token == "b";
+
+        else if (set >= 0)
+        {
+            string value;
+            if (!(args >> value) || !Options.count(token))
+            {
+                sync_cout << "info string tunematch: unknown parameter " << token << sync_endl;
+                return false;
+            }
+            s.params[set].emplace_back(token, value);
+        }
+        else if (token == "games")    args >> s.games;
+        else if (token == "slots")    args >> s.slots;
+        else if (token == "hash")     args >> s.hash;
+        else if (token == "nodes")    args >> s.limits.nodes;
+        else if (token == "movetime") args >> s.limits.movetime;
+        else if (token == "time")     args >> s.limits.time[WHITE], s.limits.time[BLACK] = s.limits.time[WHITE];
+        else if (token == "inc")      args >> s.limits.inc[WHITE],  s.limits.inc[BLACK]  = s.limits.inc[WHITE];
+        else if (token == "openings") args >> openings;
+
+    if (!s.limits.nodes && !s.limits.movetime && !s.limits.time[WHITE])
+        s.limits.nodes = 10000;
+
+    s.games = std::max(s.games, 1);
+    s.slots = std::max(1, std::min(s.slots, s.games));
+
+    // Both sets hold all the parameters, with their current values if not given
+    for (int i = 0; i < 2; ++i)
+        for (const auto& p : s.params[!i])
+            if (std::none_of(s.params[i].begin(), s.params[i].end(),
+                             [&](const pair<string, string>& q) { return q.first == p.first; }))
+                s.params[i].emplace_back(p.first, std::to_string(int(Options[p.first])));
+
+    // The openings are the bench positions or a file of them, see setup_bench().
+    // Those with moves are played out, and Chess960 ones are left out.
+    Position pos;
+    StateListPtr states(new std::deque<StateInfo>(1));
+    istringstream benchArgs("16 1 1 " + openings);
+    bool chess960 = false;
+
+    for (const string& cmd : setup_bench(pos, benchArgs))
+    {
+        if (cmd.find("UCI_Chess960") != string::npos)
+            chess960 = cmd.find("true") != string::npos;
+
+        if (cmd.compare(0, 13, "position fen ") || chess960)
+            continue;
+
+        size_t movesPos = cmd.find(" moves ");
+        istringstream is(movesPos != string::npos ? cmd.substr(movesPos + 7) : "");
+        states = StateListPtr(new std::deque<StateInfo>(1));
+        pos.set(cmd.substr(13, movesPos - 13), false, &states->back(), Threads.main());
+
+        Move m;
+        while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+        {
+            states->emplace_back();
+            pos.do_move(m, states->back());
+        }
+
+        if (MoveList<LEGAL>(pos).size())
+            s.openings.push_back(pos.fen());
+    }
+
+    if (s.openings.empty())
+    {
+        sync_cout << "info string tunematch: no openings" << sync_endl;
+        return false;
+    }
+
+    return true;
+  }
+
+} // namespace
+
+
+namespace Match {
+
+/// run() is called when the engine receives the "tunematch" command, see match.h
+
+void run(istream& args) {
+
+  Settings s;
+  int count[3] = {}; // Losses, draws and wins of set 'a'
+
+  Threads.main()->wait_for_search_finished();
+
+  if (!parse(args, s))
+      return;
+
+  auto report = [&](int r) {
+      ++count[r + 1];
+      sync_cout << result(count, false) << sync_endl;
+  };
+
+#ifndef _WIN32
+
+  // A mapped hash file would be shared with the slots
+  if (Options["HashFileMapped"])
+  {
+      sync_cout << "info string tunematch: switch off HashFileMapped first" << sync_endl;
+      return;
+  }
+
+  vector<pollfd> slots;
+  vector<pid_t> pids;
+
+  for (int slot = 0; slot < s.slots; ++slot)
+  {
+      int fd[2];
+      bool piped = !pipe(fd);
+      pid_t pid = piped ? fork() : -1;
+
+      if (pid == 0)
+      {
+          // The slot is a copy of the engine, but only with the thread that
+          // forked it. It gets a new search thread and its own TT, and sends
+          // the result of each game as one byte.
+          close(fd[0]);
+          Cluster::Sharing = false;
+          Threads.abandon();
+          Options["Hash"] = s.hash;
+          Options["Threads"] = string("1");
+
+          play_slot(s, slot, [&](int r) {
+              char c = char('1' + r);
+              if (write(fd[1], &c, 1) != 1)
+                  _exit(1);
+          });
+
+          _exit(0);
+      }
+
+      // The games of a slot that cannot be started would be missing from the
+      // result, so the match is given up.
+      if (pid < 0)
+      {
+          if (piped)
+              close(fd[0]), close(fd[1]);
+
+          for (size_t i = 0; i < pids.size(); ++i)
+              kill(pids[i], SIGTERM), close(slots[i].fd);
+
+          while (wait(nullptr) > 0) {}
+
+          sync_cout << "info string tunematch: could not start slot " << slot << sync_endl;
+          return;
+      }
+
+      close(fd[1]);
+      pids.push_back(pid);
+      slots.push_back({ fd[0], POLLIN, 0 });
+  }
+
+  for (size_t open = slots.size(); open && poll(slots.data(), slots.size(), -1) >= 0; )
+      for (pollfd& p : slots)
+          if (p.fd >= 0 && p.revents)
+          {
+              char c;
+              if (read(p.fd, &c, 1) == 1)
+                  report(c - '1');
+              else
+                  close(p.fd), p.fd = -1, --open;
+          }
+
+  while (wait(nullptr) > 0) {}
+
+#else
+
+  // Keep the current values to restore them after the match
+  Params current;
+  for (const auto& p : s.params[0])
+      current.emplace_back(p.first, std::to_string(int(Options[p.first])));
+
+  string hash = std::to_string(int(Options["Hash"]));
+  Options["Hash"] = s.hash;
+
+  s.slots = 1;
+  play_slot(s, 0, report);
+
+  apply(current);
+  Options["Hash"] = hash;
+  Search::clear();
+
+#endif
+
+  if (count[0] + count[1] + count[2] < s.games)
+      sync_cout << "info string tunematch: only " << count[0] + count[1] + count[2]
+                << " of " << s.games << " games were played" << sync_endl;
+
+  sync_cout << result(count, true) << sync_endl;
+}
+
+} // namespace Match
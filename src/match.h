@@ -0,0 +1,49 @@
+/*
+  SugaR, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  SugaR is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SugaR is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MATCH_H_INCLUDED
+#define MATCH_H_INCLUDED
+
+#include <istream>
+
+/// The 'tunematch' command plays a self-play match between two sets of values
+/// of the parameters flagged with TUNE(), so that an SPSA iteration does not
+/// need an external driver and a new engine per game:
+///
+///   tunematch [games N] [slots N] [hash MB] [nodes N | movetime ms | time ms inc ms]
+///             [openings file] [a name value ...] [b name value ...]
+///
+/// The parameters not given keep their current values in both sets. Each
+/// opening is played twice with colors reversed. The games are spread over
+/// 'slots' processes forked from the engine, each with one search thread and
+/// its own TT, which is reused from game to game. The result and an Elo
+/// estimate of set 'a' against set 'b' are reported at the end.
+///
+/// On Windows the games are played one after the other in the engine itself,
+/// with its threads and a TT of 'hash' MB, restored at the end. If a slot
+/// cannot be started, the match is given up.
+
+namespace Match {
+
+void run(std::istream& args);
+
+} // namespace Match
+
+#endif // #ifndef MATCH_H_INCLUDED
@@ -123,8 +123,13 @@ Entry* probe(const Position& pos) {
   Key key = pos.material_key();
   Entry* e = pos.this_thread()->materialTable[key];
 
+  STATS_INC(pos.this_thread(), STAT_MATERIAL_PROBE);
+
   if (e->key == key)
+  {
+      STATS_INC(pos.this_thread(), STAT_MATERIAL_HIT);
       return e;
+  }
 
   std::memset(e, 0, sizeof(Entry));
   e->key = key;
@@ -140,7 +145,7 @@ Entry* probe(const Position& pos) {
   // Let's look if we have a specialized evaluation function for this particular
   // material configuration. Firstly we look for a fixed configuration one, then
   // for a generic one if the previous search failed.
-  if ((e->evaluationFunction = pos.this_thread()->endgames.probe<Value>(key)) != nullptr)
+  if ((e->evaluationFunction = Endgames::probe<Value>(key)) != nullptr)
       return e;
 
   for (Color c = WHITE; c <= BLACK; ++c)
@@ -154,7 +159,7 @@ Entry* probe(const Position& pos) {
   // configuration. Is there a suitable specialized scaling function?
   const EndgameBase<ScaleFactor>* sf;
 
-  if ((sf = pos.this_thread()->endgames.probe<ScaleFactor>(key)) != nullptr)
+  if ((sf = Endgames::probe<ScaleFactor>(key)) != nullptr)
   {
       e->scalingFunction[sf->strongSide] = sf; // Only strong color assigned
       return e;
@@ -41,6 +41,20 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
 #endif
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#if defined(USE_DISPATCH)
+#  if defined(_MSC_VER)
+#    include <intrin.h>  // For __cpuid() and __cpuidex()
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
+
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -137,6 +151,9 @@ const string engine_info(bool to_uci) {
 
   ss << (Is64Bit ? " 64" : " 32")
      << (HasPext ? " BMI2" : (HasPopCnt ? " POPCNT" : ""))
+#if defined(USE_DISPATCH)
+     << (CPU::SlowPext ? " (dispatch, slow PEXT)" : " (dispatch)")
+#endif
      << (to_uci  ? "\nid author ": " by ")
      << "Marco Zerbinati";
 
@@ -266,11 +283,262 @@ void prefetch2(void* addr) {
   prefetch((uint8_t*)addr + 64);
 }
 
+#if defined(USE_DISPATCH)
+bool HasPopCnt, HasPext;
+#endif
+
+namespace CPU {
+
+bool SlowPext;
+
+/// CPU::init() runs cpuid, which is available in all 64 bit x86 processors,
+/// only in dispatch builds. Otherwise the code paths are fixed by the build.
+
+void init() {
+
+#if defined(USE_DISPATCH)
+
+  auto cpuid = [](unsigned leaf, unsigned r[4]) {
+#  if defined(_MSC_VER)
+      int regs[4];
+      __cpuidex(regs, int(leaf), 0);
+      for (int i = 0; i < 4; ++i)
+          r[i] = unsigned(regs[i]);
+#  else
+      __cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+#  endif
+  };
+
+  unsigned r[4];
+  char vendor[13] = {};
+
+  cpuid(0, r);
+  unsigned maxLeaf = r[0];
+  std::memcpy(vendor, &r[1], 4);
+  std::memcpy(vendor + 4, &r[3], 4);
+  std::memcpy(vendor + 8, &r[2], 4);
+
+  cpuid(1, r);
+  unsigned family = (r[0] >> 8) & 0xF;
+  if (family == 0xF)
+      family += (r[0] >> 20) & 0xFF;
+
+  bool bmi2 = false;
+  HasPopCnt = r[2] & (1 << 23);
+
+  if (maxLeaf >= 7)
+  {
+      cpuid(7, r);
+      bmi2 = r[1] & (1 << 8);
+  }
+
+  // Zen 1 and 2 (family 17h, and Hygon Dhyana 18h) run PEXT in microcode
+  SlowPext =   bmi2
+            && (!strcmp(vendor, "AuthenticAMD") || !strcmp(vendor, "HygonGenuine"))
+            && (family == 0x17 || family == 0x18);
+
+  HasPext = bmi2 && !SlowPext;
+
+#endif
+}
+
+} // namespace CPU
+
+
+namespace Startup {
+
+namespace {
+  std::vector<std::pair<const char*, int64_t>> steps; // Durations in microseconds
+}
+
+void timed(const char* step, void (*init)()) {
+
+  auto start = std::chrono::steady_clock::now();
+  init();
+  steps.emplace_back(step, std::chrono::duration_cast<std::chrono::microseconds>
+                          (std::chrono::steady_clock::now() - start).count());
+}
+
+std::string report() {
+
+  std::stringstream ss;
+  int64_t total = 0;
+
+  ss << "Startup step             us";
+
+  for (const auto& s : steps)
+  {
+      ss << "\n" << std::left << std::setw(20) << s.first
+         << std::right << std::setw(10) << s.second;
+      total += s.second;
+  }
+
+  ss << "\n" << std::left << std::setw(20) << "Total"
+     << std::right << std::setw(10) << total;
+
+  return ss.str();
+}
+
+} // namespace Startup
+
+#if defined(__linux__)
+
+/// sysfs_ids() expands a Linux sysfs list of ids like "0-3,8-11" read from the
+/// given file. Malformed ranges are skipped.
+
+std::vector<int> sysfs_ids(const std::string& path) {
+
+  constexpr int MaxId = 1 << 16;
+
+  std::ifstream file(path);
+  std::string line, range;
+  std::vector<int> ids;
+
+  if (!getline(file, line))
+      return ids;
+
+  std::stringstream ss(line);
+
+  while (getline(ss, range, ','))
+  {
+      std::istringstream rs(range);
+      int first, last;
+      char dash;
+
+      if (!(rs >> first) || first < 0)
+          continue;
+
+      if (!(rs >> dash))
+          last = first;
+      else if (dash != '-' || !(rs >> last))
+          continue;
+
+      for (int id = first; id <= std::min(last, MaxId - 1); ++id)
+          ids.push_back(id);
+  }
+
+  return ids;
+}
+
+#endif
+
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(__linux__)
+
+namespace {
+
+/// Topology holds the logical processor chosen for each thread index, built
+/// from the sysfs description of NUMA nodes and SMT siblings following the
+/// same policy as best_group() on Windows.
+
+struct Topology {
+
+  Topology() {
+
+    cpu_set_t allowed;
+    std::vector<std::vector<int>> primary, secondary;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return;
+
+    for (int node : sysfs_ids("/sys/devices/system/node/online"))
+        primary.push_back(sysfs_ids("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+
+    if (primary.empty())
+        primary.push_back(sysfs_ids("/sys/devices/system/cpu/online"));
+
+    // Split the processors of each node in the first logical processor of
+    // every core and its SMT siblings, skipping the ones we can't run on.
+    for (auto& cpus : primary)
+    {
+        std::vector<int> firsts, siblings;
+
+        for (int cpu : cpus)
+        {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+                continue;
+
+            std::vector<int> smt = sysfs_ids("/sys/devices/system/cpu/cpu"
+                                                 + std::to_string(cpu) + "/topology/thread_siblings_list");
+
+            (smt.empty() || smt[0] == cpu ? firsts : siblings).push_back(cpu);
+        }
+
+        if (firsts.empty() && siblings.empty())
+            continue; // Memory only node
+
+        cpus = firsts;
+        secondary.push_back(siblings);
+        nodes++;
+        cores += int(firsts.size());
+        threads += int(firsts.size() + siblings.size());
+    }
+
+    primary.erase(std::remove_if(primary.begin(), primary.end(),
+                                 [](const std::vector<int>& v) { return v.empty(); }), primary.end());
+
+    // Run as many threads as possible on the same node until core limit is
+    // reached, then move on filling the next node.
+    for (auto& cpus : primary)
+        cpuOf.insert(cpuOf.end(), cpus.begin(), cpus.end());
+
+    // Then spread the SMT siblings evenly across the nodes
+    for (size_t i = 0, added = 1; added; ++i)
+    {
+        added = 0;
+        for (auto& cpus : secondary)
+            if (i < cpus.size())
+                cpuOf.push_back(cpus[i]), added++;
+    }
+  }
+
+  std::vector<int> cpuOf;
+  int nodes = 0, cores = 0, threads = 0;
+};
+
+const Topology& system_topology() {
+
+  static const Topology t; // Thread safe initialization, done once
+  return t;
+}
+
+} // namespace
+
+
+/// bindThisThread() pins the current thread to the logical processor chosen
+/// for thread index idx, so that it stays on the NUMA node where its tables
+/// are allocated. Threads beyond the number of processors are left to the OS.
+
+void bindThisThread(size_t idx) {
+
+  const Topology& t = system_topology();
+
+  if (idx >= t.cpuOf.size())
+      return;
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(t.cpuOf[idx], &mask);
+  sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+
+/// topology() describes what bindThisThread() is working with
+
+std::string topology() {
+
+  const Topology& t = system_topology();
+
+  return t.cpuOf.empty() ? "" :  std::to_string(t.nodes) + " NUMA nodes, "
+                               + std::to_string(t.cores) + " cores, "
+                               + std::to_string(t.threads) + " logical processors";
+}
+
+#elif !defined(_WIN32)
 
 void bindThisThread(size_t) {}
+std::string topology() { return ""; }
 
 #else
 
@@ -367,6 +635,8 @@ void bindThisThread(size_t idx) {
       fun3(GetCurrentThread(), &affinity, nullptr);
 }
 
+std::string topology() { return ""; }
+
 #endif
 
 } // namespace WinProcGroup
@@ -21,6 +21,7 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <ostream>
@@ -56,12 +57,46 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+/// pow2_count() returns the largest power of 2 number of entries of entrySize
+/// bytes that fit in mbSize MB, at least one, or zero for a size of zero. The
+/// size is clamped to 1 TB (2 GB on 32 bit), so the byte count cannot overflow.
+
+inline size_t pow2_count(size_t mbSize, size_t entrySize) {
+
+  constexpr size_t MaxMB = size_t(1) << (sizeof(size_t) > 4 ? 20 : 11);
+
+  if (!mbSize)
+      return 0;
+
+  const size_t maxCount = (std::min(mbSize, MaxMB) << 20) / entrySize;
+  size_t count = 1;
+
+  while (count <= maxCount / 2)
+      count *= 2;
+
+  return count;
+}
+
+/// HashTable is a power of 2 sized table of entries indexed by the low bits of
+/// a key. Size is the default number of entries, resize() sets another one,
+/// rounded down to a power of 2. Resizing drops all the entries, as clear() does.
+
 template<class Entry, int Size>
 struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+  Entry* operator[](Key key) { return &table[(uint32_t)key & mask]; }
+
+  size_t size() const { return table.size(); }
+  void clear() { std::fill(table.begin(), table.end(), Entry()); }
+  void resize(size_t count) {
+    while (count & (count - 1))
+        count &= count - 1; // Clear the lowest bits until a power of 2 is left
+    if (count && count != table.size())
+        table = std::vector<Entry>(count), mask = uint32_t(count - 1);
+  }
 
 private:
   std::vector<Entry> table = std::vector<Entry>(Size);
+  uint32_t mask = Size - 1;
 };
 
 
@@ -113,10 +148,36 @@ public:
 /// logical processor group. This usually means to be limited to use max 64
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Peter Österlund. On Linux threads are pinned to single logical processors,
+/// filling NUMA nodes one after the other in the same way.
 
 namespace WinProcGroup {
   void bindThisThread(size_t idx);
+  std::string topology();
+}
+
+#if defined(__linux__)
+std::vector<int> sysfs_ids(const std::string& path);
+#endif
+
+
+/// CPU::init() reads the processor features with cpuid. In dispatch builds it
+/// sets HasPopCnt and HasPext, so it must be called before Bitboards::init()
+/// builds the attack tables in the pext or magic layout. PEXT is not used on
+/// AMD Zen 1 and 2, where it is microcoded and slower than magic multiplication.
+
+namespace CPU {
+  extern bool SlowPext; // PEXT is present but not used
+  void init();
+}
+
+
+/// Startup::timed() runs an initialization step of main() and records how long
+/// it took. Startup::report() lists the steps for the 'startup' command.
+
+namespace Startup {
+  void timed(const char* step, void (*init)());
+  std::string report();
 }
 
 #endif // #ifndef MISC_H_INCLUDED
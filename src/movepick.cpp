@@ -21,6 +21,7 @@
 #include <cassert>
 
 #include "movepick.h"
+#include "tt.h"
 
 namespace {
 
@@ -34,6 +35,10 @@ namespace {
   // Helper filter used with select()
   const auto Any = [](){ return true; };
 
+  // Number of moves whose TT entries are prefetched when a stage of the main
+  // search is entered. They are the ones most likely to be searched.
+  constexpr int PrefetchBatch = 4;
+
   // partial_insertion_sort() sorts moves in descending order up to and including
   // a given limit. The order of moves smaller than the limit is left unspecified.
   void partial_insertion_sort(ExtMove* begin, ExtMove* end, int limit) {
@@ -171,6 +176,10 @@ top:
       endMoves = generate<CAPTURES>(pos, cur);
 
       score<CAPTURES>();
+
+      if (stage == CAPTURE_INIT)
+          TT.prefetch(pos, cur, std::min(endMoves, cur + 2 * PrefetchBatch));
+
       ++stage;
       goto top;
 
@@ -190,6 +199,8 @@ top:
           || refutations[1].move == refutations[2].move)
           --endMoves;
 
+      TT.prefetch(pos, cur, endMoves);
+
       ++stage;
       /* fallthrough */
 
@@ -207,6 +218,10 @@ top:
 
       score<QUIETS>();
       partial_insertion_sort(cur, endMoves, -4000 * depth / ONE_PLY);
+
+      if (!skipQuiets)
+          TT.prefetch(pos, cur, std::min(endMoves, cur + PrefetchBatch));
+
       ++stage;
       /* fallthrough */
 
@@ -95,13 +95,71 @@ typedef Stats<Move, NOT_USED, PIECE_NB, SQUARE_NB> CounterMoveHistory;
 /// CapturePieceToHistory is addressed by a move's [piece][to][captured piece type]
 typedef Stats<int16_t, 10692, PIECE_NB, SQUARE_NB, PIECE_TYPE_NB> CapturePieceToHistory;
 
+/// PieceToStats is a table addressed by a move's [piece][to], with a memory
+/// layout picked at build time to compare their cache behaviour:
+///
+/// default          [piece][to] for the 16 piece codes
+/// CONTHIST_COMPACT [piece][to] for the 12 pieces and NO_PIECE only, so that
+///                  the continuation history shrinks from 2 MB to 1.3 MB
+/// CONTHIST_TO      [to][piece], the entries of all the pieces moving to a
+///                  square are in the same cache lines
+///
+/// The table is still indexed as table[pc][to]: with CONTHIST_TO the first
+/// index returns a Row, which strides over the pieces.
+
+#if defined(CONTHIST_COMPACT)
+constexpr int PIECE_SLOT_NB = 13;
+constexpr int piece_slot(Piece pc) { return pc - 2 * (pc > W_KING); }
+#else
+constexpr int PIECE_SLOT_NB = PIECE_NB;
+constexpr int piece_slot(Piece pc) { return pc; }
+#endif
+
+template<typename T, int D>
+struct PieceToStats {
+
+#if defined(CONTHIST_TO)
+  typedef Stats<T, D, SQUARE_NB, PIECE_SLOT_NB> Table;
+
+  template<typename E>
+  struct Row {
+    E* first;
+    E& operator[](int s) const { return first[s * PIECE_SLOT_NB]; }
+  };
+
+  // StatsEntry overloads operator&(), so the rows start from data()
+  Row<StatsEntry<T, D>> operator[](Piece pc) { return { table[0].data() + piece_slot(pc) }; }
+  Row<const StatsEntry<T, D>> operator[](Piece pc) const { return { table[0].data() + piece_slot(pc) }; }
+#else
+  typedef Stats<T, D, PIECE_SLOT_NB, SQUARE_NB> Table;
+
+  Stats<T, D, SQUARE_NB>& operator[](Piece pc) { return table[piece_slot(pc)]; }
+  const Stats<T, D, SQUARE_NB>& operator[](Piece pc) const { return table[piece_slot(pc)]; }
+#endif
+
+  void fill(const T& v) { table.fill(v); }
+
+  Table table;
+};
+
 /// PieceToHistory is like ButterflyHistory but is addressed by a move's [piece][to]
-typedef Stats<int16_t, 29952, PIECE_NB, SQUARE_NB> PieceToHistory;
+typedef PieceToStats<int16_t, 29952> PieceToHistory;
 
 /// ContinuationHistory is the combined history of a given pair of moves, usually
 /// the current one given a previous one. The nested history table is based on
-/// PieceToHistory instead of ButterflyBoards.
-typedef Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB> ContinuationHistory;
+/// PieceToHistory instead of ButterflyBoards. With CONTHIST_SHARED there is a
+/// single one for all the threads, see Thread.
+typedef PieceToStats<PieceToHistory, NOT_USED> ContinuationHistory;
+
+#if defined(CONTHIST_SHARED)
+constexpr const char* ContinuationLayout = "shared [piece][to]";
+#elif defined(CONTHIST_COMPACT)
+constexpr const char* ContinuationLayout = "compact [piece][to]";
+#elif defined(CONTHIST_TO)
+constexpr const char* ContinuationLayout = "[to][piece]";
+#else
+constexpr const char* ContinuationLayout = "[piece][to]";
+#endif
 
 
 /// MovePicker class is used to pick one pseudo legal move at a time from the
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>   // For std::memcpy
 
 #include "bitboard.h"
 #include "pawns.h"
@@ -173,6 +174,9 @@ void init() {
 }
 
 
+SharedTable SharedPawns; // Global object
+
+
 /// Pawns::probe() looks up the current position's pawns configuration in
 /// the pawns hash table. It returns a pointer to the Entry if the position
 /// is found. Otherwise a new Entry is computed and stored there, so we don't
@@ -183,8 +187,19 @@ Entry* probe(const Position& pos) {
   Key key = pos.pawn_key();
   Entry* e = pos.this_thread()->pawnsTable[key];
 
+  STATS_INC(pos.this_thread(), STAT_PAWN_PROBE);
+
   if (e->key == key)
+  {
+      STATS_INC(pos.this_thread(), STAT_PAWN_HIT);
       return e;
+  }
+
+  if (SharedPawns.probe(key, e))
+  {
+      STATS_INC(pos.this_thread(), STAT_PAWN_SHARED_HIT);
+      return e;
+  }
 
   e->key = key;
   e->scores[WHITE] = evaluate<WHITE>(pos, e);
@@ -193,10 +208,65 @@ Entry* probe(const Position& pos) {
   e->asymmetry = popcount(  (e->passedPawns[WHITE]   | e->passedPawns[BLACK])
                           | (e->semiopenFiles[WHITE] ^ e->semiopenFiles[BLACK]));
 
+  SharedPawns.store(e);
+
   return e;
 }
 
 
+/// SharedTable::resize() sets the size of the shared table in megabytes, a
+/// size of zero disables it. It must not be called during a search.
+
+void SharedTable::resize(size_t mbSize) {
+
+  size_t count = pow2_count(mbSize, sizeof(Slot));
+
+  table.reset(count ? new Slot[count]() : nullptr);
+  mask = count ? count - 1 : 0;
+}
+
+
+/// SharedTable::probe() copies the entry of the given key into e, returning
+/// false, with e left in an unspecified state, if there is none.
+
+bool SharedTable::probe(Key key, Entry* e) const {
+
+  if (!table)
+      return false;
+
+  const Slot& slot = table[key & mask];
+  uint32_t seq = slot.seq.load(std::memory_order_acquire);
+
+  if (seq & 1)
+      return false;
+
+  std::memcpy(static_cast<void*>(e), &slot.entry, sizeof(Entry));
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  return   slot.seq.load(std::memory_order_relaxed) == seq
+        && e->key == key;
+}
+
+
+/// SharedTable::store() copies e into the table, unless another thread is
+/// writing the same slot, in which case that thread wins.
+
+void SharedTable::store(const Entry* e) {
+
+  if (!table)
+      return;
+
+  Slot& slot = table[e->key & mask];
+  uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+
+  if ((seq & 1) || !slot.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+      return;
+
+  std::memcpy(&slot.entry, e, sizeof(Entry));
+  slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+
 /// Entry::evaluate_shelter() calculates the shelter bonus and the storm
 /// penalty for a king, looking at the king file and the two closest files.
 
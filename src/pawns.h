@@ -21,6 +21,9 @@
 #ifndef PAWNS_H_INCLUDED
 #define PAWNS_H_INCLUDED
 
+#include <atomic>
+#include <memory>
+
 #include "misc.h"
 #include "position.h"
 #include "types.h"
@@ -78,6 +81,32 @@ struct Entry {
 
 typedef HashTable<Entry, 16384> Table;
 
+
+/// SharedTable is an optional second level behind the per thread tables,
+/// shared by all the threads so that a pawn structure is evaluated once per
+/// search instead of once per thread. Slots are guarded by a sequence number
+/// that is odd while a writer copies an entry in, a reader copies the entry
+/// out and keeps it only if the sequence did not change meanwhile.
+
+class SharedTable {
+
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    Entry entry;
+  };
+
+public:
+  void resize(size_t mbSize);
+  bool probe(Key key, Entry* e) const;
+  void store(const Entry* e);
+
+private:
+  std::unique_ptr<Slot[]> table;
+  size_t mask = 0;
+};
+
+extern SharedTable SharedPawns;
+
 void init();
 Entry* probe(const Position& pos);
 
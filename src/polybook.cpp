@@ -22,14 +22,116 @@
 #include "uci.h"
 #include "movegen.h"
 #include "thread.h"
+#include <cstdio>
+#include <fstream>
+#include <map>
 #include <iostream>
 #include "misc.h"
 #include <sys/timeb.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
 PolyBook polybook;  // global PolyBook
 
 using namespace std;
 
+namespace {
+
+// The result of a game for book learning is taken from the first search out
+// of the book that reaches LearnDepth: a score beyond LearnMargin is counted
+// as a win or a loss, anything else as a draw.
+constexpr int LearnDepth = 10;
+constexpr Value LearnMargin = PawnValueMg;
+
+// Book entries are stored big-endian on disk and are decoded on access
+
+bool is_little_endian()
+{
+    int num = 1;
+    return (*(uint8_t *)&num == 1);
+}
+
+
+uint64_t swap_uint64(uint64_t d)
+{
+    uint64_t a;
+    uint8_t *dst = (uint8_t *)&a;
+    uint8_t *src = (uint8_t *)&d;
+
+    dst[0] = src[7];
+    dst[1] = src[6];
+    dst[2] = src[5];
+    dst[3] = src[4];
+    dst[4] = src[3];
+    dst[5] = src[2];
+    dst[6] = src[1];
+    dst[7] = src[0];
+
+    return a;
+}
+
+
+uint32_t swap_uint32(uint32_t d)
+{
+    uint32_t a;
+    uint8_t *dst = (uint8_t *)&a;
+    uint8_t *src = (uint8_t *)&d;
+
+    dst[0] = src[3];
+    dst[1] = src[2];
+    dst[2] = src[1];
+    dst[3] = src[0];
+
+    return a;
+}
+
+
+uint16_t swap_uint16(uint16_t d)
+{
+    uint16_t a;
+    uint8_t *dst = (uint8_t *)&a;
+    uint8_t *src = (uint8_t *)&d;
+
+    dst[0] = src[1];
+    dst[1] = src[0];
+
+    return a;
+}
+
+template<typename T> T from_big_endian(T d);
+template<> uint64_t from_big_endian(uint64_t d) { return is_little_endian() ? swap_uint64(d) : d; }
+template<> uint32_t from_big_endian(uint32_t d) { return is_little_endian() ? swap_uint32(d) : d; }
+template<> uint16_t from_big_endian(uint16_t d) { return is_little_endian() ? swap_uint16(d) : d; }
+
+// The swap is its own inverse
+template<typename T> T to_big_endian(T d) { return from_big_endian(d); }
+
+
+// same_file() tells if two names are those of the same file, also through
+// links or different paths where the system tells.
+
+bool same_file(const std::string& a, const std::string& b)
+{
+#ifndef _WIN32
+    struct stat sa, sb;
+
+    if (!stat(a.c_str(), &sa) && !stat(b.c_str(), &sb))
+        return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+    return a == b;
+}
+
+} // namespace
+
 // Random numbers from PolyGlot, used to compute book hash keys
 const union {
     uint64_t PolyGlotRandoms[781];
@@ -304,86 +406,429 @@ const union {
     } };
 
 
-PolyBook::PolyBook()
+/// BookImage::open() returns the image of a book file, mapping it only if no
+/// image of the same file is alive. An indexed image also serves the requests
+/// for a plain one. Returns nullptr if the file can't be opened.
+
+std::shared_ptr<const BookImage> BookImage::open(const std::string& bookfile, bool indexed)
 {
-    keycount = 0;
-    polyhash = NULL;
+    static std::mutex mutex;
+    static std::map<std::pair<std::string, bool>, std::weak_ptr<const BookImage>> images;
 
-    use_best_book_move = true;
-    max_book_depth = 255;
-    book_depth_count = 0;
+    std::unique_lock<std::mutex> lk(mutex);
 
-    last_position = 0;
-    akt_position = 0;
-    last_anz_pieces = 0;
-    akt_anz_pieces = 0;
-    search_counter = 0;
-       
-    do_search = true;
-    enabled = false;
+    for (bool idx : { true, false })
+        if (idx || !indexed)
+            if (auto image = images[std::make_pair(bookfile, idx)].lock())
+                return image;
+
+    std::shared_ptr<BookImage> image(new BookImage(bookfile));
+
+    uint64_t filesize = image->map(bookfile.c_str());
+
+    if (filesize < sizeof(PolyHash))
+        return nullptr;
+
+    image->keycount = int(filesize / sizeof(PolyHash));
+
+    if (indexed)
+        image->build_index();
+
+    images[std::make_pair(bookfile, indexed)] = image;
+    return image;
 }
 
 
-PolyBook::~PolyBook()
+BookImage::BookImage(const std::string& file) : bookfile(file)
 {
-    if (polyhash != NULL)
-        delete[]polyhash;
+    keycount = 0;
+    polyhash = nullptr;
+    baseAddress = nullptr;
+    mapping = 0;
 }
 
 
-void PolyBook::init(const std::string& bookfile)
+BookImage::~BookImage()
 {
-    if (bookfile.length() == 0) return;
-    const char *file_name = bookfile.c_str();
+    unmap();
+}
+
+/// BookImage::map() memory maps the book file read-only, the same way TBFile::map()
+/// does for the Syzygy tables. Pages are loaded on demand and the page cache copy
+/// is shared by all the engine processes using the same book. Entries are kept
+/// in their on-disk big-endian format and decoded only when accessed. Returns the
+/// size of the file, or 0 if it could not be opened or mapped.
+
+uint64_t BookImage::map(const char* file_name)
+{
+#ifndef _WIN32
+    struct stat statbuf;
+    int fd = ::open(file_name, O_RDONLY);
 
-    if (strcmp(file_name, "<empty>") == 0)
+    if (fd == -1)
+        return 0;
+
+    fstat(fd, &statbuf);
+
+    if (statbuf.st_size <= 0)
     {
-        enabled = false;
-        return;
+        ::close(fd);
+        return 0;
     }
 
-#ifdef _WIN32
-	FILE *fpt;
-	errno_t errno_local = fopen_s(&fpt, file_name, "rb");
-	if (fpt == NULL || errno_local != 0)
-	{
-		assert(errno_local != 0);
+    mapping = statbuf.st_size;
+    baseAddress = mmap(nullptr, mapping, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (baseAddress == MAP_FAILED)
+    {
+        baseAddress = nullptr;
+        return 0;
+    }
+
+    // Book probes are binary searches, so readahead would only waste I/O
+    madvise(baseAddress, mapping, MADV_RANDOM);
+
+    polyhash = (const PolyHash*)baseAddress;
+    return mapping;
 #else
-    FILE *fpt = fopen(file_name, "rb");
-    if (fpt == NULL)
+    HANDLE fd = CreateFile(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (fd == INVALID_HANDLE_VALUE)
+        return 0;
+
+    DWORD size_high;
+    DWORD size_low = GetFileSize(fd, &size_high);
+    uint64_t filesize = (uint64_t(size_high) << 32) | size_low;
+    HANDLE mmap = filesize ? CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr)
+                           : nullptr;
+    CloseHandle(fd);
+
+    if (!mmap)
+        return 0;
+
+    baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+
+    if (!baseAddress)
     {
+        CloseHandle(mmap);
+        return 0;
+    }
+
+    mapping = (uint64_t)mmap;
+    polyhash = (const PolyHash*)baseAddress;
+    return filesize;
 #endif
-        sync_cout << "info string Could not open " << bookfile << sync_endl;
-        enabled = false;
+}
+
+
+void BookImage::unmap()
+{
+    if (baseAddress)
+    {
+#ifndef _WIN32
+        munmap(baseAddress, mapping);
+#else
+        UnmapViewOfFile(baseAddress);
+        CloseHandle((HANDLE)mapping);
+#endif
+    }
+
+    baseAddress = nullptr;
+    polyhash = nullptr;
+    mapping = 0;
+    keycount = 0;
+
+    eytzinger_keys.clear();
+    eytzinger_first.clear();
+}
+
+
+uint64_t BookImage::entry_key(int i) const
+{
+    return from_big_endian(polyhash[i].key);
+}
+
+
+uint16_t BookImage::entry_move(int i) const
+{
+    return from_big_endian(polyhash[i].move);
+}
+
+
+uint16_t BookImage::entry_weight(int i) const
+{
+    return from_big_endian(polyhash[i].weight);
+}
+
+
+uint32_t BookImage::entry_learn(int i) const
+{
+    return from_big_endian(polyhash[i].learn);
+}
+
+
+/// BookImage::find_first() returns the first entry with the given key, or -1
+/// if the key is not in the book.
+
+int BookImage::find_first(uint64_t key) const
+{
+    return eytzinger_keys.empty() ? binary_search(key) : indexed_search(key);
+}
+
+
+/// BookImage::binary_search() returns the first entry with the given key by
+/// bisecting the book records directly, or -1 if the key is not in the book.
+
+int BookImage::binary_search(uint64_t key) const
+{
+    int start = 0;
+    int end = keycount;
+
+    for (;;)
+    {
+        int mid = (end + start) / 2;
+
+        if (entry_key(mid) < key)
+            start = mid;
+        else
+        {
+            if (entry_key(mid) > key)
+                end = mid;
+            else
+            {
+                start = max(mid - 4, 0);
+                end = min(mid + 4, keycount);
+            }
+        }
+
+        if (end - start < 9)
+            break;
+    }
+
+    for (int i = start; i < end; i++)
+    {
+        if (key == entry_key(i))
+        {
+            int first = i;
+            while ((first > 0) && (key == entry_key(first - 1)))
+                first--;
+            return first;
+        }
+    }
+
+    return -1;
+}
+
+
+/// BookImage::indexed_search() does the same as binary_search() but walks the
+/// Eytzinger ordered copy of the distinct keys. The children of node k are 2k
+/// and 2k+1, so the next levels of the search are in a few cache lines that
+/// we can prefetch well before they are needed, instead of taking a dependent
+/// cache miss at every bisection step in the mapped records.
+
+int BookImage::indexed_search(uint64_t key) const
+{
+    const size_t n = eytzinger_keys.size() - 1;
+    size_t k = 1;
+
+    while (k <= n)
+    {
+        // A cache line holds 8 keys, so this is the node 4 levels below
+        if (16 * k <= n)
+            prefetch(const_cast<uint64_t*>(&eytzinger_keys[16 * k]));
+
+        k = 2 * k + (eytzinger_keys[k] < key);
+    }
+
+    // Undo the right turns taken after the last left turn: the node where we
+    // turned left is the smallest key not less than 'key'.
+    while (k & 1)
+        k >>= 1;
+    k >>= 1;
+
+    return k && eytzinger_keys[k] == key ? eytzinger_first[k] : -1;
+}
+
+
+/// BookImage::build_index() creates the Eytzinger layout of the distinct book
+/// keys, with each node pointing to the first record for that key. The index
+/// costs 12 bytes per book position and a full pass over the file at load
+/// time, so it is built only for the images opened with the BookIndex option.
+
+void BookImage::build_index()
+{
+    eytzinger_keys.clear();
+    eytzinger_first.clear();
+
+    if (!keycount)
         return;
+
+    std::vector<uint64_t> keys;
+    std::vector<int> first;
+
+    for (int i = 0; i < keycount; i++)
+    {
+        uint64_t key = entry_key(i);
+
+        if (keys.empty() || keys.back() != key)
+            keys.push_back(key), first.push_back(i);
     }
 
-    if (polyhash != NULL)
+    // Slot 0 is unused, the root of the implicit tree is at index 1
+    eytzinger_keys.resize(keys.size() + 1);
+    eytzinger_first.resize(keys.size() + 1);
+
+    size_t i = 0;
+    fill_index(keys, first, i, 1);
+}
+
+
+void BookImage::fill_index(const std::vector<uint64_t>& keys, const std::vector<int>& first,
+                           size_t& i, size_t k)
+{
+    // In-order traversal of the implicit tree visits the slots in key order
+    if (k >= eytzinger_keys.size())
+        return;
+
+    fill_index(keys, first, i, 2 * k);
+    eytzinger_keys[k] = keys[i];
+    eytzinger_first[k] = first[i++];
+    fill_index(keys, first, i, 2 * k + 1);
+}
+
+/// BookImage::learning() returns the results merged from the update log of the
+/// book, reading the log the first time it is called. The returned map is never
+/// modified, so it can be used without locking while other games add results.
+
+std::shared_ptr<const BookImage::LearnMap> BookImage::learning() const
+{
+    std::unique_lock<std::mutex> lk(learnMutex);
+
+    if (learned)
+        return learned;
+
+    // The log is a sequential read of 16 bytes per learned move, cheap even
+    // after thousands of games.
+    const std::string learn_file = bookfile + ".learn";
+    std::shared_ptr<LearnMap> lm = std::make_shared<LearnMap>();
+    std::ifstream log(learn_file, ios::binary);
+    PolyHash rec;
+    size_t records = 0;
+
+    while (log.read((char*)&rec, sizeof(rec)))
+    {
+        uint64_t key = from_big_endian(rec.key);
+        uint16_t move = from_big_endian(rec.move);
+        uint16_t points = from_big_endian(rec.weight);
+
+        if (points > 2)
+            continue;
+
+        LearnStats& ls = (*lm)[learn_key(key, move)];
+        ls.games++;
+        ls.points += points;
+        records++;
+    }
+
+    if (records)
+        sync_cout << "info string Book learning: " << records << " results for "
+                  << lm->size() << " moves from " << learn_file << sync_endl;
+
+    learned = lm;
+    return learned;
+}
+
+
+/// BookImage::add_results() appends the result of a game for each book move
+/// played to the update log and publishes a new copy of the merged results.
+/// The book is never written, so this costs a few small appends between games.
+/// The log records have the book format, with the points in the weight field.
+
+void BookImage::add_results(const PlayedMoves& moves, int points) const
+{
+    if (moves.empty())
+        return;
+
+    learning(); // Read the log first, results are added to it
+
+    std::unique_lock<std::mutex> lk(learnMutex);
+
+    const std::string learn_file = bookfile + ".learn";
+    std::shared_ptr<LearnMap> lm = std::make_shared<LearnMap>(*learned);
+    std::ofstream log(learn_file, ios::binary | ios::app);
+
+    for (const auto& pm : moves)
     {
-        free(polyhash);
-        polyhash = NULL;
+        PolyHash rec;
+        rec.key    = to_big_endian(pm.first);
+        rec.move   = to_big_endian(pm.second);
+        rec.weight = to_big_endian(uint16_t(points));
+        rec.learn  = 0;
+        log.write((const char*)&rec, sizeof(rec));
+
+        LearnStats& ls = (*lm)[learn_key(pm.first, pm.second)];
+        ls.games++;
+        ls.points += points;
     }
 
-    fseek(fpt, 0L, SEEK_END);
-    int filesize = ftell(fpt);
-    fseek(fpt, 0L, SEEK_SET);
+    if (!log)
+        sync_cout << "info string Could not write " << learn_file << sync_endl;
 
-    keycount = filesize / 16;
-    polyhash = new PolyHash[keycount];
+    learned = lm;
+}
+
+
+uint64_t BookImage::learn_key(uint64_t key, uint16_t move)
+{
+    return key ^ (uint64_t(move) * 0x9E3779B97F4A7C15ULL);
+}
 
-    fread(polyhash, 1, filesize, fpt);
-    fclose(fpt);
 
-    for (int i = 0; i<keycount; i++)
-        byteswap_polyhash(&polyhash[i]);
+PolyBook::PolyBook()
+{
+    use_best_book_move = true;
+    use_book_index = false;
+    use_learning = false;
+    game_points = -1;
+    max_book_depth = 255;
+    book_depth_count = 0;
+
+    last_position = 0;
+    akt_position = 0;
+    last_anz_pieces = 0;
+    akt_anz_pieces = 0;
+    search_counter = 0;
+       
+    do_search = true;
+}
+
+
+void PolyBook::init(const std::string& bookfile)
+{
+    if (bookfile.length() == 0) return;
+
+    save_learning();
+    learned.reset();
+    book.reset();
+
+    if (bookfile == "<empty>")
+        return;
+
+    book = BookImage::open(bookfile, use_book_index);
+
+    if (!book)
+    {
+        sync_cout << "info string Could not open " << bookfile << sync_endl;
+        return;
+    }
 
     sr = time(NULL);
     for (int i = 0; i < 10; i++)
         rand64();
 
     sync_cout << "info string Book loaded: " << bookfile << sync_endl;
-
-    enabled = true;
 }
 
 
@@ -399,16 +844,37 @@ void PolyBook::set_book_depth(int book_depth)
 }
 
 
+void PolyBook::set_book_index(bool book_index)
+{
+    use_book_index = book_index;
+
+    if (book && book->indexed() != use_book_index)
+        book = BookImage::open(book->file(), use_book_index);
+}
+
+
+void PolyBook::set_learning(bool learning)
+{
+    use_learning = learning;
+    game_moves.clear();
+    game_points = -1;
+    learned.reset();
+}
+
+
 Move PolyBook::probe(Position& pos)
 {
     Move m1 = MOVE_NONE;
 
-    if (!enabled) return m1;
+    if (!book) return m1;
     if (!check_do_search(pos)) return m1;   
 
     if (book_depth_count >= max_book_depth)
         return m1;
 
+    if (use_learning)
+        learned = book->learning();
+
     Key key = polyglot_key(pos);
 
     int n = find_first_key(key);
@@ -436,28 +902,150 @@ Move PolyBook::probe(Position& pos)
     else
         idx1 = index_rand;
    
-    m1 = pg_move_to_sf_move(pos, polyhash[idx1].move);
+    m1 = pg_move_to_sf_move(pos, book->entry_move(idx1));
 
-    if (!pos.is_draw(64)) return m1;
-    if (n == 1) return m1;
+    if (!pos.is_draw(64)) return played(key, idx1, m1);
+    if (n == 1) return played(key, idx1, m1);
                 
     // special case draw position and 2 moves available
 
     if (!check_draw(m1, pos))
-        return m1;
+        return played(key, idx1, m1);
 
     int idx2 = index_first;
     if (idx1 == idx2)
         idx2 = index_first + 1;   
-    Move  m2 = pg_move_to_sf_move(pos, polyhash[idx2].move);
+    Move  m2 = pg_move_to_sf_move(pos, book->entry_move(idx2));
     
     if (!check_draw(m2, pos))
-        return m2;
+        return played(key, idx2, m2);
         
     return MOVE_NONE;
 }
 
 
+/// PolyBook::played() records the book entry of a move returned by probe(), so
+/// that the result of the game can be credited to it by save_learning().
+
+Move PolyBook::played(Key key, int idx, Move m)
+{
+    if (use_learning && m != MOVE_NONE)
+    {
+        game_moves.emplace_back(key, book->entry_move(idx));
+        game_points = -1; // Decided again when we leave the book
+    }
+
+    return m;
+}
+
+
+/// PolyBook::learn() is called after every search with its score and depth.
+/// The first deep enough search after the last book move of the game decides
+/// its result from our point of view.
+
+void PolyBook::learn(Value score, Depth depth)
+{
+    if (game_moves.empty() || game_points >= 0 || depth < LearnDepth * ONE_PLY)
+        return;
+
+    game_points = score >= LearnMargin ? 2 : score <= -LearnMargin ? 0 : 1;
+}
+
+
+/// PolyBook::save_learning() hands the result of the game to the book image,
+/// which logs it and merges it with the results of the other games. Entries
+/// whose moves have been learned get their weight scaled, see entry_weight().
+
+void PolyBook::save_learning()
+{
+    if (book && game_points >= 0)
+        book->add_results(game_moves, game_points);
+
+    game_moves.clear();
+    game_points = -1;
+}
+
+
+/// PolyBook::compact() writes a copy of the book with the learned weights, and
+/// the game and point counts added to the learn field of each entry (16 bits
+/// each). The copy is written to a temporary file and renamed, so the loaded
+/// book can be replaced while its entries are read from the mapping, in which
+/// case it is loaded again. The update log of the written book is removed, as
+/// its results are now in the entries.
+
+void PolyBook::compact(const std::string& bookfile)
+{
+    if (!book)
+    {
+        sync_cout << "info string No book loaded" << sync_endl;
+        return;
+    }
+
+    save_learning();
+    learned = book->learning();
+
+    const std::string tmpfile = bookfile + ".tmp";
+    const std::string loaded = book->file();
+    const bool replace = same_file(bookfile, loaded);
+    const int entries = book->size();
+    std::ofstream file(tmpfile, ios::binary | ios::trunc);
+    int updated = 0;
+
+    for (int i = 0; i < entries; i++)
+    {
+        PolyHash rec = book->entry(i);
+        auto it = learned->find(BookImage::learn_key(book->entry_key(i), book->entry_move(i)));
+
+        if (it != learned->end())
+        {
+            uint32_t learn  = book->entry_learn(i);
+            uint32_t games  = std::min((learn >> 16) + it->second.games, 0xFFFFu);
+            uint32_t points = std::min((learn & 0xFFFF) + it->second.points, 0xFFFFu);
+            uint16_t weight = entry_weight(i);
+
+            learn = (games << 16) | points;
+            rec.weight = to_big_endian(weight);
+            rec.learn  = to_big_endian(learn);
+            updated++;
+        }
+
+        file.write((const char*)&rec, sizeof(rec));
+    }
+
+    file.close();
+    learned.reset();
+
+    if (!file)
+    {
+        std::remove(tmpfile.c_str());
+        sync_cout << "info string Could not write " << tmpfile << sync_endl;
+        return;
+    }
+
+    // A mapped file can't be replaced on Windows, so the book is released first
+    if (replace)
+        book.reset();
+
+#ifdef _WIN32
+    std::remove(bookfile.c_str());
+#endif
+
+    bool renamed = !std::rename(tmpfile.c_str(), bookfile.c_str());
+
+    if (renamed)
+        std::remove((bookfile + ".learn").c_str());
+
+    if (!renamed)
+        sync_cout << "info string Could not rename " << tmpfile << " to " << bookfile << sync_endl;
+    else
+        sync_cout << "info string Book written to " << bookfile << ": " << entries
+                  << " entries, " << updated << " learned" << sync_endl;
+
+    if (replace && !(book = BookImage::open(loaded, use_book_index)))
+        sync_cout << "info string Could not open " << loaded << sync_endl;
+}
+
+
 Key PolyBook::polyglot_key(const Position & pos)
 {
     Key key = 0;
@@ -486,6 +1074,7 @@ Key PolyBook::polyglot_key(const Position & pos)
     return key;
 }
 
+
 // A PolyGlot book move is encoded as follows:
 //
 // bit  0- 5: destination square (from 0 to 63)
@@ -529,64 +1118,80 @@ int PolyBook::find_first_key(uint64_t key)
     index_best = -1;
     index_rand = -1;
 
-    int start = 0;
-    int end = keycount;
+    index_first = book->find_first(key);
 
-    for (;;)
-    {
-        int mid = (end + start) / 2;
+    return index_first < 0 ? -1 : get_key_data();
+}
 
-        if (polyhash[mid].key < key)
-            start = mid;
-        else
-        {
-            if (polyhash[mid].key > key)
-                end = mid;
-            else
-            {
-                start = max(mid - 4, 0);
-                end = min(mid + 4, keycount);
-            }
-        }
 
-        if (end - start < 9)
-            break;
+/// PolyBook::bench() measures the average cost of a book key lookup with plain
+/// binary search and with the Eytzinger index. Half of the probes are for keys
+/// sampled from the book, the other half for random keys that are most likely
+/// missing, which is the common case once out of the opening.
+
+void PolyBook::bench(int probes)
+{
+    if (!book)
+    {
+        cerr << "No book loaded" << endl;
+        return;
     }
 
-    for (int i = start; i < end; i++)
+    std::vector<uint64_t> keys;
+    PRNG rng(1070372);
+
+    for (int i = 0; i < probes; i++)
+        keys.push_back(i & 1 ? rng.rand<uint64_t>() : book->entry_key(int(rng.rand<uint64_t>() % book->size())));
+
+    // Reuses the index of our image if it has one
+    TimePoint elapsed = now();
+    std::shared_ptr<const BookImage> image = BookImage::open(book->file(), true);
+    TimePoint buildTime = now() - elapsed;
+
+    int found[2] = { 0, 0 };
+    TimePoint time[2];
+
+    for (int idx = 0; idx < 2; idx++)
     {
-        if (key == polyhash[i].key)
-        {
-            index_first = i;
-            while ((index_first>0) && (key == polyhash[index_first - 1].key))
-                index_first--;
-            return get_key_data();
-        }
+        elapsed = now();
+
+        for (uint64_t key : keys)
+            found[idx] += (idx ? image->indexed_search(key) : image->binary_search(key)) >= 0;
+
+        time[idx] = now() - elapsed;
     }
 
-    return -1;
+    cerr << "\n==========================="
+         << "\nBook entries    : " << image->size()
+         << "\nProbes (found)  : " << probes << " (" << found[0] << ")"
+         << "\nIndex build (ms): " << buildTime
+         << "\nBinary  (ns/probe) : " << 1000000.0 * time[0] / probes
+         << "\nIndexed (ns/probe) : " << 1000000.0 * time[1] / probes << endl;
+
+    if (found[0] != found[1])
+        cerr << "Index mismatch: " << found[1] << " keys found" << endl;
 }
 
 
 int PolyBook::get_key_data()
 {
-    int best_weight = polyhash[index_first].weight;
+    int best_weight = entry_weight(index_first);
     index_weight_count = best_weight;
-    uint64_t key = polyhash[index_first].key;
+    uint64_t key = book->entry_key(index_first);
 
     index_count = 1;
     index_best = index_first;
 
-    for (int i = index_first + 1; i<keycount; i++)
+    for (int i = index_first + 1; i < book->size(); i++)
     {
-        if (polyhash[i].key != key)
+        if (book->entry_key(i) != key)
             break;
 
         index_count++;
-        index_weight_count += polyhash[i].weight;
-        if (polyhash[i].weight > best_weight)
+        index_weight_count += entry_weight(i);
+        if (entry_weight(i) > best_weight)
         {
-            best_weight = polyhash[i].weight;
+            best_weight = entry_weight(i);
             index_best = i;
         }
     }
@@ -597,12 +1202,12 @@ int PolyBook::get_key_data()
 
     for (int i = index_first; i < index_first + index_count; i++)
     {
-        if ((rand_pos >= weight_count) && (rand_pos < weight_count + polyhash[i].weight))
+        if ((rand_pos >= weight_count) && (rand_pos < weight_count + entry_weight(i)))
         {
             index_rand = i;
             break;
         }
-        weight_count += polyhash[i].weight;
+        weight_count += entry_weight(i);
     }
 
     return index_count;
@@ -652,75 +1257,30 @@ bool PolyBook::check_draw(Move m, Position & pos)
 }
 
 
-void PolyBook::byteswap_polyhash(PolyHash *ph)
-{
-    if (is_little_endian())
-    {
-        ph->key = swap_uint64(ph->key);
-        ph->move = swap_uint16(ph->move);
-        ph->weight = swap_uint16(ph->weight);
-        ph->learn = swap_uint32(ph->learn);
-    }
-}
-
-
-uint64_t PolyBook::rand64()
-{
-    sr ^= sr >> 12, sr ^= sr << 25, sr ^= sr >> 27;
-    return sr * 2685821657736338717LL;
-}
-
+// The learned weight is scaled by (points + 1) / (games + 1): unchanged after
+// draws, it tends to twice the book weight with wins and to 1 with losses, so
+// that a book move is never dropped.
 
-bool PolyBook::is_little_endian()
+uint16_t PolyBook::entry_weight(int i)
 {
-    int num = 1;
-    return (*(uint8_t *)&num == 1);
-}
+    uint16_t w = book->entry_weight(i);
 
+    if (!learned || learned->empty() || !w)
+        return w;
 
-uint64_t PolyBook::swap_uint64(uint64_t d)
-{
-    uint64_t a;
-    uint8_t *dst = (uint8_t *)&a;
-    uint8_t *src = (uint8_t *)&d;
+    auto it = learned->find(BookImage::learn_key(book->entry_key(i), book->entry_move(i)));
 
-    dst[0] = src[7];
-    dst[1] = src[6];
-    dst[2] = src[5];
-    dst[3] = src[4];
-    dst[4] = src[3];
-    dst[5] = src[2];
-    dst[6] = src[1];
-    dst[7] = src[0];
+    if (it == learned->end())
+        return w;
 
-    return a;
-}
-
-
-uint32_t PolyBook::swap_uint32(uint32_t d)
-{
-    uint32_t a;
-    uint8_t *dst = (uint8_t *)&a;
-    uint8_t *src = (uint8_t *)&d;
+    uint64_t lw = uint64_t(w) * (it->second.points + 1) / (it->second.games + 1);
 
-    dst[0] = src[3];
-    dst[1] = src[2];
-    dst[2] = src[1];
-    dst[3] = src[0];
-
-    return a;
+    return uint16_t(std::max(std::min(lw, uint64_t(0xFFFF)), uint64_t(1)));
 }
 
 
-uint16_t PolyBook::swap_uint16(uint16_t d)
+uint64_t PolyBook::rand64()
 {
-    uint16_t a;
-    uint8_t *dst = (uint8_t *)&a;
-    uint8_t *src = (uint8_t *)&d;
-
-    dst[0] = src[1];
-    dst[1] = src[0];
-
-    return a;
+    sr ^= sr >> 12, sr ^= sr << 25, sr ^= sr >> 27;
+    return sr * 2685821657736338717LL;
 }
-
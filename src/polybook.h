@@ -25,6 +25,11 @@
 #include "position.h"
 #include "string.h"
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 typedef struct {
     uint64_t key;
     uint16_t move;
@@ -32,19 +37,97 @@ typedef struct {
     uint32_t learn;
 } PolyHash;
 
+/// BookImage is the read-only part of a book: the entries mapped from the file,
+/// the optional Eytzinger index of their keys and the game results merged from
+/// the update log. Opening a file that is already open returns the same image,
+/// so that all the PolyBook probers of a process (one per game) share a single
+/// copy, while the mapping shares the page cache with the other processes using
+/// the book. All the methods can be called concurrently.
+
+class BookImage
+{
+public:
+
+    // Results of the games where a book move was played: points are counted
+    // as 2 for a win, 1 for a draw and 0 for a loss.
+    struct LearnStats {
+        uint32_t games;
+        uint32_t points;
+    };
+
+    typedef std::unordered_map<uint64_t, LearnStats> LearnMap; // See learn_key()
+    typedef std::vector<std::pair<uint64_t, uint16_t>> PlayedMoves;
+
+    static std::shared_ptr<const BookImage> open(const std::string& bookfile, bool indexed);
+    ~BookImage();
+
+    const std::string& file() const { return bookfile; }
+    int size() const { return keycount; }
+    bool indexed() const { return !eytzinger_keys.empty(); }
+
+    const PolyHash& entry(int i) const { return polyhash[i]; }
+    uint64_t entry_key(int i) const;
+    uint16_t entry_move(int i) const;
+    uint16_t entry_weight(int i) const;
+    uint32_t entry_learn(int i) const;
+
+    int find_first(uint64_t key) const;
+    int binary_search(uint64_t key) const;
+    int indexed_search(uint64_t key) const;
+
+    std::shared_ptr<const LearnMap> learning() const;
+    void add_results(const PlayedMoves& moves, int points) const;
+    static uint64_t learn_key(uint64_t key, uint16_t move);
+
+private:
+
+    explicit BookImage(const std::string& bookfile);
+
+    uint64_t map(const char* file_name);
+    void unmap();
+    void build_index();
+    void fill_index(const std::vector<uint64_t>& keys, const std::vector<int>& first,
+                    size_t& i, size_t k);
+
+    std::string bookfile;
+    int keycount;
+    const PolyHash *polyhash; // Big-endian entries, mapped from the book file
+    void *baseAddress;
+    uint64_t mapping;
+
+    std::vector<uint64_t> eytzinger_keys; // Distinct keys in Eytzinger order, 1-based
+    std::vector<int> eytzinger_first;     // First record index for each key
+
+    // The merged update log is read on first use and replaced by a new copy
+    // each time results are added, so probers can keep using their snapshot.
+    mutable std::mutex learnMutex;
+    mutable std::shared_ptr<const LearnMap> learned;
+};
+
+/// PolyBook is the state of book probing for one game on top of a BookImage: the
+/// options, the entries selected by the last probe, the random generator, the
+/// position tracking of check_do_search() and the book moves played for book
+/// learning. The engine plays one game at a time with the global 'polybook'.
+
 class PolyBook
 {
 public:
 
     PolyBook();
-    ~PolyBook();
 
     void init(const std::string& bookfile);
     void set_best_book_move(bool best_book_move);
     void set_book_depth(int book_depth);
+    void set_book_index(bool book_index);
+    void set_learning(bool learning);
+    void bench(int probes);
 
     Move probe(Position& pos);
 
+    void learn(Value score, Depth depth);
+    void save_learning();
+    void compact(const std::string& bookfile);
+
 private:
 
     Key polyglot_key(const Position& pos);
@@ -56,18 +139,19 @@ private:
     bool check_do_search(const Position & pos);
     bool check_draw(Move m, Position& pos);
 
-    void byteswap_polyhash(PolyHash *ph);
-    uint64_t rand64();
+    Move played(Key key, int idx, Move m);
+    uint16_t entry_weight(int i);
 
-    bool is_little_endian();
-    uint64_t swap_uint64(uint64_t d);
-    uint32_t swap_uint32(uint32_t d);
-    uint16_t swap_uint16(uint16_t d);
+    uint64_t rand64();
 
-    int keycount;
-    PolyHash *polyhash;
+    std::shared_ptr<const BookImage> book;
+    std::shared_ptr<const BookImage::LearnMap> learned; // Snapshot used by probe()
+    BookImage::PlayedMoves game_moves;                  // Book moves of this game
+    int game_points;                                    // Result once out of book, or -1
 
     bool use_best_book_move;
+    bool use_book_index;
+    bool use_learning;
     int max_book_depth;
     int book_depth_count;
 
@@ -85,7 +169,7 @@ private:
     int akt_anz_pieces;
     int search_counter;
 
-    bool enabled, do_search;
+    bool do_search;
 };
 
 extern PolyBook polybook;
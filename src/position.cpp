@@ -318,6 +318,13 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Th
   thisThread = th;
   set_state(st);
 
+#if defined(ATTACK_MAPS)
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      attackMap[s] = piece_attacks(s);
+
+  st->mapUndoCount = 0;
+#endif
+
   assert(pos_is_ok());
 
   return *this;
@@ -351,10 +358,13 @@ void Position::set_castling_right(Color c, Square rfrom) {
 }
 
 
-/// Position::set_check_info() sets king attacks to detect if a move gives check
+/// Position::set_check_info() sets king attacks to detect if a move gives check.
+/// It is called by check_info() the first time they are needed after a move.
 
 void Position::set_check_info(StateInfo* si) const {
 
+  si->hasCheckInfo = true;
+
   si->blockersForKing[WHITE] = slider_blockers(pieces(BLACK), square<KING>(WHITE), si->pinners[BLACK]);
   si->blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), si->pinners[WHITE]);
 
@@ -493,6 +503,67 @@ const string Position::fen() const {
 /// a pinned or a discovered check piece, according if its color is the opposite
 /// or the same of the color of the slider.
 
+#if defined(ATTACK_MAPS)
+
+/// Position::piece_attacks() computes from scratch the squares attacked by the
+/// piece on square s with the current occupancy, or 0 if the square is empty.
+
+Bitboard Position::piece_attacks(Square s) const {
+
+  Piece pc = piece_on(s);
+
+  return  pc == NO_PIECE      ? 0
+        : type_of(pc) == PAWN ? PawnAttacks[color_of(pc)][s]
+                              : attacks_bb(type_of(pc), s, pieces());
+}
+
+
+/// Position::update_attack_map() brings the attack map in line with the board
+/// after the pieces on the 'changed' squares have been moved, captured or
+/// dropped. Besides those squares only sliders whose rays run through one of
+/// them need a refresh. The overwritten entries are saved in the current
+/// StateInfo, so undo_move() restores them without recomputing anything.
+
+void Position::update_attack_map(Bitboard changed) {
+
+  int n = 0;
+  Bitboard b = changed | ((pieces(BISHOP, ROOK) | pieces(QUEEN)) & ~changed);
+
+  while (b)
+  {
+      Square s = pop_lsb(&b);
+
+      if (!(changed & s) && !(attackMap[s] & changed))
+          continue;
+
+      Bitboard att = piece_attacks(s);
+
+      if (att != attackMap[s])
+      {
+          assert(n < StateInfo::MaxMapUndo);
+
+          st->mapUndoSquare[n] = s;
+          st->mapUndo[n++] = attackMap[s];
+          attackMap[s] = att;
+      }
+  }
+
+  st->mapUndoCount = n;
+}
+
+
+/// Position::restore_attack_map() reverts the attack map entries logged by the
+/// last update_attack_map() call.
+
+void Position::restore_attack_map() {
+
+  for (int n = st->mapUndoCount - 1; n >= 0; --n)
+      attackMap[st->mapUndoSquare[n]] = st->mapUndo[n];
+}
+
+#endif
+
+
 Bitboard Position::slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const {
 
   Bitboard blockers = 0;
@@ -657,13 +728,14 @@ bool Position::gives_check(Move m) const {
 
   Square from = from_sq(m);
   Square to = to_sq(m);
+  const StateInfo* ci = check_info();
 
   // Is there a direct check?
-  if (st->checkSquares[type_of(piece_on(from))] & to)
+  if (ci->checkSquares[type_of(piece_on(from))] & to)
       return true;
 
   // Is there a discovered check?
-  if (   (st->blockersForKing[~sideToMove] & from)
+  if (   (ci->blockersForKing[~sideToMove] & from)
       && !aligned(from, to, square<KING>(~sideToMove)))
       return true;
 
@@ -707,7 +779,7 @@ void Position::removePawn(Square s, StateInfo& newSt) {
 	assert(&newSt != st);
 	assert(type_of(piece_on(s)) == PAWN);
 
-	std::memcpy(&newSt, st, offsetof(StateInfo, key));
+	std::memcpy(&newSt, st, offsetof(StateInfo, capturedPiece));
 	newSt.previous = st;
 	st = &newSt;
 
@@ -722,14 +794,21 @@ void Position::removePawn(Square s, StateInfo& newSt) {
 	st->epSquare= SQ_NONE;
 	board[s] = NO_PIECE;
 	st->checkersBB = attackers_to(square<KING>(sideToMove)) & pieces(~sideToMove);
-	set_check_info(st);
+	st->hasCheckInfo = false;
 
 	st->materialKey ^= Zobrist::psq[pc][pieceCount[pc]];
 	st->capturedPiece = NO_PIECE;
 	st->key = k;
+
+#if defined(ATTACK_MAPS)
+	update_attack_map(SquareBB[s]);
+#endif
 }
 
 void Position::undo_removePawn(Square s, Color c) {
+#if defined(ATTACK_MAPS)
+  restore_attack_map();
+#endif
   st = st->previous;
   Piece pc = make_piece(c, PAWN);
   put_piece(pc, s);
@@ -751,7 +830,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   // Copy some fields of the old state to our new StateInfo object except the
   // ones which are going to be recalculated from scratch anyway and then switch
   // our state pointer to point to the new (ready to be updated) state.
-  std::memcpy(&newSt, st, offsetof(StateInfo, key));
+  std::memcpy(&newSt, st, offsetof(StateInfo, capturedPiece));
   newSt.previous = st;
   st = &newSt;
 
@@ -894,8 +973,16 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
   sideToMove = ~sideToMove;
 
-  // Update king attacks used for fast check detection
-  set_check_info(st);
+#if defined(ATTACK_MAPS)
+  // Refresh the attack map around the squares touched by the move. For castling
+  // 'to' has already been set to the king destination by do_castling().
+  update_attack_map(  SquareBB[from] | to_sq(m) | to
+                    | (type_of(m) == CASTLING  ? SquareBB[relative_square(us, to_sq(m) > from ? SQ_F1 : SQ_D1)]
+                     : type_of(m) == ENPASSANT ? SquareBB[to - pawn_push(us)] : 0));
+#endif
+
+  // King attacks used for fast check detection are computed on demand
+  st->hasCheckInfo = false;
 
   assert(pos_is_ok());
 }
@@ -957,6 +1044,10 @@ void Position::undo_move(Move m) {
       }
   }
 
+#if defined(ATTACK_MAPS)
+  restore_attack_map();
+#endif
+
   // Finally point our state pointer back to the previous state
   st = st->previous;
   --gamePly;
@@ -1010,7 +1101,7 @@ void Position::do_null_move(StateInfo& newSt) {
 
   sideToMove = ~sideToMove;
 
-  set_check_info(st);
+  st->hasCheckInfo = false;
 
   assert(pos_is_ok());
 }
@@ -1051,6 +1142,8 @@ bool Position::see_ge(Move m, Value threshold) const {
 
   assert(is_ok(m));
 
+  STATS_INC(thisThread, STAT_SEE);
+
   // Only deal with normal moves, assume others pass a simple see
   if (type_of(m) != NORMAL)
       return VALUE_ZERO >= threshold;
@@ -1083,6 +1176,7 @@ bool Position::see_ge(Move m, Value threshold) const {
   // removed, but possibly an X-ray attacker added behind it.
   Bitboard occupied = pieces() ^ from ^ to;
   Bitboard attackers = attackers_to(to, occupied) & occupied;
+  const StateInfo* ci = check_info();
 
   while (true)
   {
@@ -1090,8 +1184,8 @@ bool Position::see_ge(Move m, Value threshold) const {
 
       // Don't allow pinned pieces to attack (except the king) as long as
       // all pinners are on their original square.
-      if (!(st->pinners[~stm] & ~occupied))
-          stmAttackers &= ~st->blockersForKing[stm];
+      if (!(ci->pinners[~stm] & ~occupied))
+          stmAttackers &= ~ci->blockersForKing[stm];
 
       // If stm has no more attackers then give up: stm loses
       if (!stmAttackers)
@@ -1313,11 +1407,17 @@ bool Position::pos_is_ok() const {
           if (p1 != p2 && (pieces(p1) & pieces(p2)))
               assert(0 && "pos_is_ok: Bitboards");
 
-  StateInfo si = *st;
+  StateInfo si = *check_info();
   set_state(&si);
   if (std::memcmp(&si, st, sizeof(StateInfo)))
       assert(0 && "pos_is_ok: State");
 
+#if defined(ATTACK_MAPS)
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      if (attackMap[s] != piece_attacks(s))
+          assert(0 && "pos_is_ok: Attack map");
+#endif
+
   for (Piece pc : Pieces)
   {
       if (   pieceCount[pc] != popcount(pieces(color_of(pc), type_of(pc)))
@@ -37,22 +37,34 @@
 struct StateInfo {
 
   // Copied when making a move
-  Key    pawnKey;
-  Key    materialKey;
-  Value  nonPawnMaterial[COLOR_NB];
-  int    castlingRights;
-  int    rule50;
-  int    pliesFromNull;
-  Square epSquare;
-
-  // Not copied when making a move (will be recomputed anyhow)
+  Key     pawnKey;
+  Key     materialKey;
+  Value   nonPawnMaterial[COLOR_NB];
+  int     castlingRights;
+  Square  epSquare;
+  int16_t rule50;
+  int16_t pliesFromNull;
+
+  // Not copied when making a move (will be recomputed anyhow). The fields up
+  // to 'previous' fill the first 64 bytes, the ones used at every node.
+  Piece      capturedPiece;
   Key        key;
   Bitboard   checkersBB;
-  Piece      capturedPiece;
   StateInfo* previous;
+
+  // Check info, computed by set_check_info() only when first needed
+  bool       hasCheckInfo;
   Bitboard   blockersForKing[COLOR_NB];
   Bitboard   pinners[COLOR_NB];
   Bitboard   checkSquares[PIECE_TYPE_NB];
+
+#if defined(ATTACK_MAPS)
+  // Attack map entries overwritten by the move, restored by undo_move()
+  static constexpr int MaxMapUndo = 40;
+  int        mapUndoCount;
+  Square     mapUndoSquare[MaxMapUndo];
+  Bitboard   mapUndo[MaxMapUndo];
+#endif
 };
 
 /// A list to keep track of the position states along the setup moves (from the
@@ -114,6 +126,9 @@ public:
   template<PieceType> Bitboard attacks_from(Square s) const;
   template<PieceType> Bitboard attacks_from(Square s, Color c) const;
   Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
+#if defined(ATTACK_MAPS)
+  Bitboard attacks_of(Square s) const;
+#endif
 
   // Properties of moves
   bool legal(Move m) const;
@@ -169,6 +184,7 @@ private:
   void set_castling_right(Color c, Square rfrom);
   void set_state(StateInfo* si) const;
   void set_check_info(StateInfo* si) const;
+  const StateInfo* check_info() const;
 
   // Other helpers
   void put_piece(Piece pc, Square s);
@@ -176,6 +192,11 @@ private:
   void move_piece(Piece pc, Square from, Square to);
   template<bool Do>
   void do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto);
+#if defined(ATTACK_MAPS)
+  Bitboard piece_attacks(Square s) const;
+  void update_attack_map(Bitboard changed);
+  void restore_attack_map();
+#endif
 
   // Data members
   Piece board[SQUARE_NB];
@@ -193,6 +214,9 @@ private:
   Thread* thisThread;
   StateInfo* st;
   bool chess960;
+#if defined(ATTACK_MAPS)
+  Bitboard attackMap[SQUARE_NB]; // Squares attacked by the piece on each square
+#endif
 };
 
 namespace PSQT {
@@ -295,6 +319,12 @@ inline Bitboard Position::attacks_from(PieceType pt, Square s) const {
   return attacks_bb(pt, s, byTypeBB[ALL_PIECES]);
 }
 
+#if defined(ATTACK_MAPS)
+inline Bitboard Position::attacks_of(Square s) const {
+  return attackMap[s];
+}
+#endif
+
 inline Bitboard Position::attackers_to(Square s) const {
   return attackers_to(s, byTypeBB[ALL_PIECES]);
 }
@@ -303,12 +333,18 @@ inline Bitboard Position::checkers() const {
   return st->checkersBB;
 }
 
+inline const StateInfo* Position::check_info() const {
+  if (!st->hasCheckInfo)
+      set_check_info(st);
+  return st;
+}
+
 inline Bitboard Position::blockers_for_king(Color c) const {
-  return st->blockersForKing[c];
+  return check_info()->blockersForKing[c];
 }
 
 inline Bitboard Position::check_squares(PieceType pt) const {
-  return st->checkSquares[pt];
+  return check_info()->checkSquares[pt];
 }
 
 inline bool Position::pawn_passed(Color c, Square s) const {
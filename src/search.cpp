@@ -23,9 +23,11 @@
 #include <cmath>
 #include <cstring>   // For std::memset
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 #include "polybook.h"
+#include "cluster.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
@@ -66,6 +68,47 @@ namespace {
   constexpr int SkipSize[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
   constexpr int SkipPhase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
 
+  // skip_block() returns the skip-block of the i-th helper thread. The tables
+  // above are continued along the same pattern, 2 * n threads with blocks of
+  // size n, up to SMPSkipWrap helpers, then the schedule starts again.
+  void skip_block(size_t i, int& size, int& phase) {
+
+    i %= std::max(size_t(Options["SMPSkipWrap"]), size_t(1));
+
+    if (i < 20)
+    {
+        size = SkipSize[i], phase = SkipPhase[i];
+        return;
+    }
+
+    for (i -= 20, size = 5; i >= size_t(2 * size); i -= 2 * size, ++size) {}
+
+    phase = int(i);
+  }
+
+  // pv_block() returns the MultiPV lines [start, end) of the i-th of n helper
+  // threads. Instead of all searching every line after the main thread, the
+  // helpers split the lines, taking the current order of the lines of the main
+  // thread at each iteration and leaving out the lines above their block, which
+  // they keep in that order. They run ahead of the main thread,
+  // which then finds the other lines in the TT when it gets to them. With more
+  // helpers than lines, each line gets several helpers.
+  void pv_block(size_t i, size_t n, size_t multiPV, size_t& start, size_t& end) {
+
+    if (n >= multiPV)
+        start = i % multiPV, end = start + 1;
+    else
+        start = i * multiPV / n, end = (i + 1) * multiPV / n;
+  }
+
+  // Minimum time in ms between two outputs of the PV lines in the middle of
+  // a MultiPV iteration
+  constexpr TimePoint PvOutputInterval = 1000;
+
+  // The zugzwang verification in null move search may use at most 1/16 of
+  // the nodes of a thread
+  constexpr uint64_t ZugzwangBudget = 16;
+
   // Razor and futility margins
   constexpr int RazorMargin = 600;
   Value futility_margin(Depth d, bool improving) {
@@ -131,30 +174,111 @@ namespace {
           : pos.gives_check(move);
   }
 
+  // PerftTable memoizes the leaf counts of perft subtrees, indexed by position
+  // key and depth. It is shared by all the threads without locks: an entry
+  // stores the count and the key xor-ed with it, so that an entry written
+  // concurrently by two threads fails the key check and is just a miss.
+  class PerftTable {
+
+    struct Entry {
+      std::atomic<uint64_t> check, count;
+    };
+
+    std::unique_ptr<Entry[]> table;
+    size_t mask = 0, mbSize = 0;
+
+  public:
+    void resize(size_t mb) {
+
+      if (mb == mbSize)
+          return;
+
+      size_t count = pow2_count(mb, sizeof(Entry));
+
+      table.reset(count ? new Entry[count]() : nullptr);
+      mask = count ? count - 1 : 0;
+      mbSize = mb;
+    }
+
+    bool probe(Key key, uint64_t& cnt) const {
+
+      if (!table)
+          return false;
+
+      const Entry& e = table[key & mask];
+      uint64_t c = e.count.load(std::memory_order_relaxed);
+
+      if ((e.check.load(std::memory_order_relaxed) ^ c) != key)
+          return false;
+
+      cnt = c;
+      return true;
+    }
+
+    void store(Key key, uint64_t cnt) {
+
+      if (!table)
+          return;
+
+      Entry& e = table[key & mask];
+      e.check.store(key ^ cnt, std::memory_order_relaxed);
+      e.count.store(cnt, std::memory_order_relaxed);
+    }
+  };
+
+  PerftTable PerftTT;
+
+  // Root moves of the running perft, handed out to the threads one at a time
+  std::vector<Move> PerftMoves;
+  std::vector<uint64_t> PerftCounts;
+  std::atomic<size_t> PerftNext;
+
   // perft() is our utility to verify move generation. All the leaf nodes up
-  // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
+  // to the given depth, at least 2, are generated and counted, and the sum
+  // is returned. Subtrees of depth 3 or more are looked up in PerftTT.
   uint64_t perft(Position& pos, Depth depth) {
 
     StateInfo st;
-    uint64_t cnt, nodes = 0;
+    uint64_t nodes = 0;
     const bool leaf = (depth == 2 * ONE_PLY);
+    const Key key = pos.key() ^ (Key(depth / ONE_PLY) * 0x9E3779B97F4A7C15ULL);
+
+    if (!leaf && PerftTT.probe(key, nodes))
+        return nodes;
 
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= ONE_PLY)
-            cnt = 1, nodes++;
-        else
+        pos.do_move(m, st);
+        nodes += leaf ? MoveList<LEGAL>(pos).size() : perft(pos, depth - ONE_PLY);
+        pos.undo_move(m);
+    }
+
+    if (!leaf)
+        PerftTT.store(key, nodes);
+
+    return nodes;
+  }
+
+  // perft_root() is run by every thread of the pool. It takes the next not
+  // yet counted root move until all of them are done.
+  void perft_root(Position& pos, Depth depth) {
+
+    StateInfo st;
+    size_t i;
+
+    while ((i = PerftNext++) < PerftMoves.size())
+    {
+        if (depth <= ONE_PLY)
         {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - ONE_PLY);
-            nodes += cnt;
-            pos.undo_move(m);
+            PerftCounts[i] = 1;
+            continue;
         }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
+
+        pos.do_move(PerftMoves[i], st);
+        PerftCounts[i] =  depth == 2 * ONE_PLY ? MoveList<LEGAL>(pos).size()
+                        : perft(pos, depth - ONE_PLY);
+        pos.undo_move(PerftMoves[i]);
     }
-    return nodes;
   }
 
 } // namespace
@@ -194,9 +318,10 @@ void Search::clear() {
 	return;
 //end_Hash
 
-  Threads.main()->wait_for_search_finished();
+  Threads.wait_for_main();
 
   Time.availableNodes = 0;
+  Time.credit = 0;
   TT.clear();
   Threads.clear();
 }
@@ -209,8 +334,42 @@ void MainThread::search() {
 
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft * ONE_PLY);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      TimePoint elapsed = now();
+
+      PerftTT.resize(Options["PerftHash"]);
+      PerftMoves.clear();
+      for (const auto& m : MoveList<LEGAL>(rootPos))
+          PerftMoves.push_back(m);
+      PerftCounts.assign(PerftMoves.size(), 0);
+      PerftNext = 0;
+
+      for (Thread* th : Threads)
+          if (th != this)
+              th->start_searching();
+
+      perft_root(rootPos, Limits.perft * ONE_PLY);
+
+      for (Thread* th : Threads)
+          if (th != this)
+          {
+              th->wait_for_search_finished();
+              th->nodes = 0; // Count only the leaves, not the do_move() calls
+          }
+
+      elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+      nodes = 0;
+      bestThread = this;
+
+      for (size_t i = 0; i < PerftMoves.size(); ++i)
+      {
+          nodes += PerftCounts[i];
+          sync_cout << UCI::move(PerftMoves[i], rootPos.is_chess960()) << ": "
+                    << PerftCounts[i] << sync_endl;
+      }
+
+      sync_cout << "\nNodes searched: " << nodes
+                << "\nTime (ms)     : " << elapsed
+                << "\nNodes/second  : " << 1000 * nodes / elapsed << "\n" << sync_endl;
       return;
   }
 
@@ -225,28 +384,50 @@ void MainThread::search() {
 
   // Read search options
   tactical = Options["ICCF Analyzes"];
+  lastPvOutput = 0;
+  pvSent.clear();
+  rootOrder.clear();
   
   if (rootMoves.empty())
   {
       rootMoves.emplace_back(MOVE_NONE);
-      sync_cout << "info depth 0 score "
-                << UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
-                << sync_endl;
+
+      if (!Limits.silent)
+          sync_cout << "info depth 0 score "
+                    << UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
+                    << sync_endl;
   }
   else
   {
       Move bookMove = MOVE_NONE;
 
-      if (!Limits.infinite && !Limits.mate)
+      // Silent searches (analyse jobs, tunematch games) are not games of the
+      // book: they neither play its moves nor feed its learning.
+      if (!Limits.infinite && !Limits.mate && !Limits.silent)
           bookMove = polybook.probe(rootPos);
 
       if (bookMove && std::count(rootMoves.begin(), rootMoves.end(), bookMove))
       {
+          if (Limits.use_time_management())
+              Time.book_move();
+
           for (Thread* th : Threads)
               std::swap(th->rootMoves[0], *std::find(th->rootMoves.begin(), th->rootMoves.end(), bookMove));
       }
       else
       {
+          if (!Limits.silent)
+              Cluster::go(rootPos);
+
+          // Spend less time on a position the TT already knows well, see adjust()
+          if (Limits.use_time_management())
+          {
+              bool ttHit;
+              TTEntry* tte = TT.probe(rootPos.key(), ttHit);
+              Time.adjust(ttHit ? tte->depth() : DEPTH_NONE,
+                          ttHit ? tte->bound() : BOUND_NONE, previousDepth);
+          }
+
           for (Thread* th : Threads)
               if (th != this)
                   th->start_searching();
@@ -274,14 +455,16 @@ void MainThread::search() {
       if (th != this)
           th->wait_for_search_finished();
 
+  Cluster::finish_search();
+
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
   if (Limits.npmsec)
       Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
 
   // Check if there are threads with a better score than main thread
-  Thread* bestThread = this;
-  if (    int(Options["MultiPV"]) == 1
+  bestThread = this;
+  if (    multiPV == 1
       && !Limits.depth
 												 
       &&  rootMoves[0].pv[0] != MOVE_NONE)
@@ -313,18 +496,45 @@ void MainThread::search() {
       }
   }
 
+  // Let the workers of a cluster vote in the same way, see cluster.h
+  Move bestMove = bestThread->rootMoves[0].pv[0];
+  if (    multiPV == 1
+      && !Limits.depth
+      &&  bestMove != MOVE_NONE)
+      bestMove = Cluster::vote(rootPos, bestMove, bestThread->rootMoves[0].score, bestThread->completedDepth);
+
   previousScore = bestThread->rootMoves[0].score;
+  previousDepth = bestThread->completedDepth;
+
+  if (!Limits.infinite && !Limits.mate && !Limits.silent)
+      polybook.learn(bestThread->rootMoves[0].score, bestThread->completedDepth);
+
+  if (Limits.silent)
+      return;
 
   // Send again PV info if we have a new best thread
   if (bestThread != this)
       sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
 
+  // A move voted by the cluster comes without a PV to ponder on
+  if (bestMove != bestThread->rootMoves[0].pv[0])
+  {
+      sync_cout << "bestmove " << UCI::move(bestMove, rootPos.is_chess960()) << sync_endl;
+      return;
+  }
+
   sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
-  if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
+  bool hasPonder = bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos);
+
+  if (hasPonder)
       std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
 
   std::cout << sync_endl;
+
+  // In a game, rank the next tablebase roots while the opponent thinks
+  if (Limits.use_time_management())
+      Tablebases::prefetch_roots(rootPos, bestMove, hasPonder ? bestThread->rootMoves[0].pv[1] : MOVE_NONE);
 }
 
 
@@ -334,6 +544,12 @@ void MainThread::search() {
 
 void Thread::search() {
 
+  if (Limits.perft)
+  {
+      perft_root(rootPos, Limits.perft * ONE_PLY);
+      return;
+  }
+
   Stack stack[MAX_PLY+7], *ss = stack+4; // To reference from (ss-4) to (ss+2)
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
@@ -355,9 +571,12 @@ void Thread::search() {
   
   doNull = Options["NullMove"];
   
-  if (tactical) multiPV = size_t(pow(2, tactical));
+  // ICCF analysis searches at least 2^tactical lines
+  multiPV = size_t(Options["MultiPV"]);
+  if (tactical)
+      multiPV = std::max(multiPV, size_t(1) << tactical);
   zugzwangMates=0;
-  multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
+  multiPV = std::min(multiPV, rootMoves.size());
   
   int ct = int(Options["Contempt"]) * PawnValueEg / 100; // From centipawns
 
@@ -373,23 +592,48 @@ void Thread::search() {
   contempt = (us == WHITE ?  make_score(ct, ct / 2)
                           : -make_score(ct, ct / 2));
 
+  // The threads of the workers of a cluster continue the schedule of the master
+  size_t helper = idx + Cluster::rank() * Threads.size();
+  int skipSize = 1, skipPhase = 0;
+  if (helper > 0)
+      skip_block(helper - 1, skipSize, skipPhase);
+
+  // In MultiPV mode the helpers search only a block of the lines, see pv_block()
+  size_t pvStart = 0, pvEnd = multiPV;
+  if (idx > 0 && multiPV > 1)
+      pv_block(idx - 1, Threads.size() - 1, multiPV, pvStart, pvEnd);
+
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   (rootDepth += ONE_PLY) < DEPTH_MAX
          && !Threads.stop
          && !(Limits.depth && mainThread && rootDepth / ONE_PLY > Limits.depth))
   {
       // Distribute search depths across the helper threads
-      if (idx > 0)
-      {
-          int i = (idx - 1) % 20;
-          if (((rootDepth / ONE_PLY + SkipPhase[i]) / SkipSize[i]) % 2)
-              continue;  // Retry with an incremented rootDepth
-      }
+      if (helper > 0 && ((rootDepth / ONE_PLY + skipPhase) / skipSize) % 2)
+          continue;  // Retry with an incremented rootDepth
 
       // Age out PV variability metric
       if (mainThread)
           mainThread->bestMoveChanges *= 0.517, failedLow = false;
 
+      // Take the current order of the lines of the main thread, so that the
+      // lines above the block of a helper are those, see pv_block()
+      if (idx > 0 && multiPV > 1)
+      {
+          std::vector<Move> order;
+          {
+              std::lock_guard<Mutex> lk(Threads.main()->rootOrderMutex);
+              order = Threads.main()->rootOrder;
+          }
+
+          for (size_t i = 0; i < order.size() && i < rootMoves.size(); ++i)
+          {
+              auto it = std::find(rootMoves.begin() + i, rootMoves.end(), order[i]);
+              if (it != rootMoves.end())
+                  std::rotate(rootMoves.begin() + i, it, it + 1);
+          }
+      }
+
       // Save the last iteration's scores before first PV line is searched and
       // all the move scores except the (new) PV are set to -VALUE_INFINITE.
       for (RootMove& rm : rootMoves)
@@ -399,9 +643,9 @@ void Thread::search() {
       pvLast = 0;
 
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = pvStart; pvIdx < pvEnd && !Threads.stop; ++pvIdx)
       {
-          if (pvIdx == pvLast)
+          while (pvIdx >= pvLast)
           {
               pvFirst = pvLast;
               for (pvLast++; pvLast < rootMoves.size(); pvLast++)
@@ -453,7 +697,8 @@ void Thread::search() {
               if (   mainThread
                   && multiPV == 1
                   && (bestValue <= alpha || bestValue >= beta)
-                  && Time.elapsed() > 3000)
+                  && Time.elapsed() > 3000
+                  && !Limits.silent)
                   sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
 
               // In case of failing low/high increase aspiration window and
@@ -484,11 +729,32 @@ void Thread::search() {
           }
 
           // Sort the PV lines searched so far and update the GUI
-          std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
+          std::stable_sort(rootMoves.begin() + std::max(pvFirst, pvStart), rootMoves.begin() + pvIdx + 1);
+
+          if (mainThread && multiPV > 1)
+          {
+              std::lock_guard<Mutex> lk(mainThread->rootOrderMutex);
+              mainThread->rootOrder.clear();
+              for (size_t i = 0; i < multiPV; ++i)
+                  mainThread->rootOrder.push_back(rootMoves[i].pv[0]);
+          }
 
+          // After 3 seconds also between lines, at most every PvOutputInterval
+          // and only for the lines that changed since they were last sent. The
+          // string is built before taking the output lock.
           if (    mainThread
-              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-              sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+              && (   Threads.stop
+                  || pvIdx + 1 == multiPV
+                  || (   Time.elapsed() > 3000
+                      && Time.elapsed() - mainThread->lastPvOutput >= PvOutputInterval))
+              && !Limits.silent)
+          {
+              std::string info = UCI::pv(rootPos, rootDepth, alpha, beta, &mainThread->pvSent);
+              mainThread->lastPvOutput = Time.elapsed();
+
+              if (!info.empty())
+                  sync_cout << info << sync_endl;
+          }
       }
 
       if (!Threads.stop)
@@ -651,6 +917,18 @@ namespace {
     excludedMove = ss->excludedMove;
     posKey = pos.key() ^ Key(excludedMove << 16); // Isn't a very good hash
     tte = TT.probe(posKey, ttHit);
+    STATS_INC(thisThread, STAT_TT_PROBE);
+    if (ttHit)
+    {
+        thisThread->ttHits.fetch_add(1, std::memory_order_relaxed);
+        STATS_INC(thisThread, STAT_TT_HIT);
+    }
+#ifdef SEARCH_STATS
+    // Moves of false hits and of entries torn by other threads
+    if (ttHit && tte->move() && !pos.pseudo_legal(tte->move()))
+        STATS_INC(thisThread, STAT_TT_BAD_MOVE);
+    STATS_ADD(thisThread, STAT_TT_TORN, TT.torn_entries(posKey));
+#endif
     ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ttHit    ? tte->move() : MOVE_NONE;
@@ -683,6 +961,7 @@ namespace {
                 update_continuation_histories(ss, pos.moved_piece(ttMove), to_sq(ttMove), penalty);
             }
         }
+        STATS_INC(thisThread, STAT_TT_CUT);
         return ttValue;
     }
 
@@ -804,6 +1083,7 @@ namespace {
         ss->continuationHistory = &thisThread->continuationHistory[NO_PIECE][0];
 
         pos.do_null_move(st);
+        STATS_INC(thisThread, STAT_NULL_TRY);
 
         Value nullValue = -search<NonPV>(pos, ss+1, -beta, -beta+1, depth-R, !cutNode);
 
@@ -811,6 +1091,8 @@ namespace {
 
         if (nullValue >= beta)
         {
+            STATS_INC(thisThread, STAT_NULL_CUT);
+
             // Do not return unproven mate scores
             if (nullValue >= VALUE_MATE_IN_MAX_PLY)
                 nullValue = beta;
@@ -826,6 +1108,7 @@ namespace {
                    && !inCheck
         	       && abs(thisThread->rootMoves[0].score) < 4800
          	       && thisThread->zugzwangMates < 20
+                   && thisThread->zugzwangNodes * ZugzwangBudget <= thisThread->nodes.load(std::memory_order_relaxed)
         	       && (pe = Pawns::probe(pos)) != nullptr
         	       && popcount(pe->passedPawns[us])
         	       && popcount(pe->passedPawns[us]) <= 2
@@ -833,62 +1116,96 @@ namespace {
         	       && popcount(pos.pieces())   <= 12
         	       && MoveList<LEGAL, KING>(pos).size() < 1)
             {
-                bool oneOpponentPasser = popcount(pe->passedPawns[~us]) == 1 &&
-                                        !(pos.pieces() & forward_file_bb(~us, lsb(pe->passedPawns[~us])));
-                Bitboard passed = pe->passedPawns[us] & ~pos.blockers_for_king(us) &  ~pos.blockers_for_king(~us);
-                while (passed)
+                // Positions are probed once per depth, transpositions get the cached outcome
+                Search::ZugzwangEntry* ze = thisThread->zugzwangTable[posKey];
+                bool mate = false;
+
+                if (ze->key == posKey && ze->depth >= depth / ONE_PLY)
                 {
-                   Square s = pop_lsb(&passed);
-                   Square promo = make_square(file_of(s), us == WHITE ? RANK_8 : RANK_1);
-                   if ((pos.pieces() & between_bb(promo, s)) || promo == pos.square<KING>(us)) // king can't move
-                      continue; // passer blocked
-                   Move directPromotion = make_move(s, promo);
-                   bool killPromo =  (pos.pieces(~us) & promo) || !pos.see_ge(directPromotion); // opponent controls promotion-square
-                   if (!killPromo && !oneOpponentPasser)
-					  continue;
-
-                   StateInfo s1,s2,s3;
-                   Square p2, p3 = SQ_NONE;
-                   if (oneOpponentPasser && !killPromo)
-                   {
-                       Rank r1 = relative_rank(~us, rank_of(lsb(pe->passedPawns[~us])));
-                       Rank r2 = relative_rank( us, rank_of(s));
-                       if (r2 > r1)
-                         continue; // if our passed is more advanced we will promote earlier and probably defend with success
-                       if (pawn_attack_span(us, s) & pos.pieces(~us, PAWN))
-                       { // pseudo passed pawn: will be passed after levers
-                          p2 = lsb(pawn_attack_span(us, s) & pos.pieces(~us, PAWN));
-                          Bitboard removeLevers = forward_file_bb(~us, p2) & pos.pieces( us, PAWN);
-                          if (removeLevers)
-                          {
-                            p3 = lsb(removeLevers);
-                            pos.removePawn(p2, s2);
-                            pos.removePawn(p3, s3);
-                          }
+                    STATS_INC(thisThread, STAT_ZUGZWANG_CACHED);
+                    mate = ze->mate;
+                }
+                else
+                {
+                    uint64_t probeStart = thisThread->nodes.load(std::memory_order_relaxed);
+
+                    bool oneOpponentPasser = popcount(pe->passedPawns[~us]) == 1 &&
+                                            !(pos.pieces() & forward_file_bb(~us, lsb(pe->passedPawns[~us])));
+                    Bitboard passed = pe->passedPawns[us] & ~pos.blockers_for_king(us) &  ~pos.blockers_for_king(~us);
+                    while (passed)
+                    {
+                       Square s = pop_lsb(&passed);
+                       Square promo = make_square(file_of(s), us == WHITE ? RANK_8 : RANK_1);
+                       if ((pos.pieces() & between_bb(promo, s)) || promo == pos.square<KING>(us)) // king can't move
+                          continue; // passer blocked
+                       Move directPromotion = make_move(s, promo);
+                       bool killPromo =  (pos.pieces(~us) & promo) || !pos.see_ge(directPromotion); // opponent controls promotion-square
+                       if (!killPromo && !oneOpponentPasser)
+    					  continue;
+
+                       StateInfo s1,s2,s3;
+                       Square p2, p3 = SQ_NONE;
+                       if (oneOpponentPasser && !killPromo)
+                       {
+                           Rank r1 = relative_rank(~us, rank_of(lsb(pe->passedPawns[~us])));
+                           Rank r2 = relative_rank( us, rank_of(s));
+                           if (r2 > r1)
+                             continue; // if our passed is more advanced we will promote earlier and probably defend with success
+                           if (pawn_attack_span(us, s) & pos.pieces(~us, PAWN))
+                           { // pseudo passed pawn: will be passed after levers
+                              p2 = lsb(pawn_attack_span(us, s) & pos.pieces(~us, PAWN));
+                              Bitboard removeLevers = forward_file_bb(~us, p2) & pos.pieces( us, PAWN);
+                              if (removeLevers)
+                              {
+                                p3 = lsb(removeLevers);
+                                pos.removePawn(p2, s2);
+                                pos.removePawn(p3, s3);
+                              }
+                           }
+    				   }
+
+                       STATS_INC(thisThread, STAT_ZUGZWANG_PROBE);
+                       thisThread->nmpMinPly = MAX_PLY;
+                       pos.removePawn(s, s1);
+                       Move pv1[MAX_PLY+1];
+                       (ss)->pv = pv1;
+                       (ss)->pv[0] = MOVE_NONE;
+                       Depth nd = (oneOpponentPasser && !killPromo) ? depth - R - 2 * ONE_PLY : depth - 4 * ONE_PLY;
+                       Value v = search<PV>(pos, ss, mated_in(0), VALUE_MATED_IN_MAX_PLY, nd , false);
+
+                       pos.undo_removePawn(s, us);
+                       if (p3 != SQ_NONE) // reput the lever pawns
+                          pos.undo_removePawn(p3, us), pos.undo_removePawn(p2, ~us);
+
+                       if (v > mated_in(0) && v < VALUE_MATED_IN_MAX_PLY)
+                       {
+                         //sync_cout << pos << "info mate " << UCI::value(v) << " detected with depth " << nd << " !  at score " << thisThread->rootMoves[0].score << sync_endl;
+                         mate = true;
+                         break;
                        }
-				   }
-
-                   thisThread->nmpMinPly = MAX_PLY;
-                   pos.removePawn(s, s1);
-                   Move pv1[MAX_PLY+1];
-                   (ss)->pv = pv1;
-                   (ss)->pv[0] = MOVE_NONE;
-                   Depth nd = (oneOpponentPasser && !killPromo) ? depth - R - 2 * ONE_PLY : depth - 4 * ONE_PLY;
-                   Value v = search<PV>(pos, ss, mated_in(0), VALUE_MATED_IN_MAX_PLY, nd , false);
-
-                   pos.undo_removePawn(s, us);
-                   if (p3 != SQ_NONE) // reput the lever pawns
-                      pos.undo_removePawn(p3, us), pos.undo_removePawn(p2, ~us);
-
-                   if (v > mated_in(0) && v < VALUE_MATED_IN_MAX_PLY)
-                   {
-                     //sync_cout << pos << "info mate " << UCI::value(v) << " detected with depth " << nd << " !  at score " << thisThread->rootMoves[0].score << sync_endl;
-                     thisThread->zugzwangMates++;
-					 thisThread->nmpMinPly = 0;
-                     // Early return here with a low value, this will spotlight this promising variation
-                     return Value(thisThread->rootMoves[0].score * (thisThread->rootPos.side_to_move() != us ? 1 : -1) - 80);
-                   }
-                } // end processing of passed pawns
+                    } // end processing of passed pawns
+
+                    uint64_t probeNodes = thisThread->nodes.load(std::memory_order_relaxed) - probeStart;
+                    thisThread->zugzwangNodes += probeNodes;
+                    STATS_ADD(thisThread, STAT_ZUGZWANG_NODES, probeNodes);
+
+                    // An interrupted probe proves nothing
+                    if (!Threads.stop.load(std::memory_order_relaxed))
+                    {
+                        ze->key = posKey;
+                        ze->depth = int16_t(depth / ONE_PLY);
+                        ze->mate = mate;
+                    }
+                }
+
+                if (mate)
+                {
+                    thisThread->zugzwangMates++;
+                    STATS_INC(thisThread, STAT_ZUGZWANG_MATE);
+                    thisThread->nmpMinPly = 0;
+                    // Early return here with a low value, this will spotlight this promising variation
+                    return Value(thisThread->rootMoves[0].score * (thisThread->rootPos.side_to_move() != us ? 1 : -1) - 80);
+                }
             }
             
             // Do verification search at high depths, with null move pruning disabled
@@ -920,6 +1237,7 @@ namespace {
             if (move != excludedMove && pos.legal(move))
             {
                 probCutCount++;
+                STATS_INC(thisThread, STAT_PROBCUT_TRY);
 
                 ss->currentMove = move;
                 ss->continuationHistory = &thisThread->continuationHistory[pos.moved_piece(move)][to_sq(move)];
@@ -938,7 +1256,10 @@ namespace {
                 pos.undo_move(move);
 
                 if (value >= rbeta)
+                {
+                    STATS_INC(thisThread, STAT_PROBCUT_CUT);
                     return value;
+                }
             }
     }
 
@@ -988,7 +1309,7 @@ moves_loop: // When in check, search starts from here
 
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
+      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000 && !Limits.silent)
           sync_cout << "info depth " << depth / ONE_PLY
                     << " currmove " << UCI::move(move, pos.is_chess960())
                     << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
@@ -1146,6 +1467,9 @@ moves_loop: // When in check, search starts from here
           value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
 
           doFullDepthSearch = (value > alpha && d != newDepth);
+          STATS_INC(thisThread, STAT_LMR);
+          if (doFullDepthSearch)
+              STATS_INC(thisThread, STAT_LMR_RESEARCH);
       }
       else
           doFullDepthSearch = !PvNode || moveCount > 1;
@@ -1223,6 +1547,8 @@ moves_loop: // When in check, search starts from here
               else
               {
                   assert(value >= beta); // Fail high
+                  STATS_INC(thisThread, STAT_CUTOFF);
+                  STATS_ADD(thisThread, STAT_CUTOFF_FIRST, moveCount == 1);
                   ss->statScore = 0;
                   break;
               }
@@ -1282,10 +1608,16 @@ moves_loop: // When in check, search starts from here
         bestValue = std::min(bestValue, maxValue);
 
     if (!excludedMove)
-        tte->save(posKey, value_to_tt(bestValue, ss->ply),
-                  bestValue >= beta ? BOUND_LOWER :
-                  PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
-                  depth, bestMove, pureStaticEval);
+    {
+        Bound b =  bestValue >= beta ? BOUND_LOWER
+                 : PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER;
+
+        tte->save(posKey, value_to_tt(bestValue, ss->ply), b, depth, bestMove, pureStaticEval);
+
+        // Send the deep entries to the other nodes of a cluster
+        if (Cluster::Sharing && depth >= Cluster::ShareDepth)
+            Cluster::share(posKey, value_to_tt(bestValue, ss->ply), b, depth, bestMove, pureStaticEval);
+    }
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1328,6 +1660,7 @@ moves_loop: // When in check, search starts from here
     ss->continuationHistory = &thisThread->continuationHistory[NO_PIECE][0];
     inCheck = pos.checkers();
     moveCount = 0;
+    STATS_INC(thisThread, STAT_QS_NODE);
 
     // Check for an immediate draw or maximum ply reached
     if (   pos.is_draw(ss->ply)
@@ -1344,6 +1677,18 @@ moves_loop: // When in check, search starts from here
     // Transposition table lookup
     posKey = pos.key();
     tte = TT.probe(posKey, ttHit);
+    STATS_INC(thisThread, STAT_TT_PROBE);
+    if (ttHit)
+    {
+        thisThread->ttHits.fetch_add(1, std::memory_order_relaxed);
+        STATS_INC(thisThread, STAT_TT_HIT);
+    }
+#ifdef SEARCH_STATS
+    // Moves of false hits and of entries torn by other threads
+    if (ttHit && tte->move() && !pos.pseudo_legal(tte->move()))
+        STATS_INC(thisThread, STAT_TT_BAD_MOVE);
+    STATS_ADD(thisThread, STAT_TT_TORN, TT.torn_entries(posKey));
+#endif
     ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
     ttMove = ttHit ? tte->move() : MOVE_NONE;
 
@@ -1353,7 +1698,10 @@ moves_loop: // When in check, search starts from here
         && ttValue != VALUE_NONE // Only in case of TT access race
         && (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
                             : (tte->bound() & BOUND_UPPER)))
+    {
+        STATS_INC(thisThread, STAT_TT_CUT);
         return ttValue;
+    }
 
     // Evaluate the position statically
     if (inCheck)
@@ -1621,6 +1969,8 @@ void MainThread::check_time() {
   // When using nodes, ensure checking rate is not lower than 0.1% of nodes
   callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
 
+  Cluster::flush();
+
   static TimePoint lastInfoTime = now();
 
   TimePoint elapsed = Time.elapsed();
@@ -1645,16 +1995,23 @@ void MainThread::check_time() {
 
 /// UCI::pv() formats PV information according to the UCI protocol. UCI requires
 /// that all (if any) unsearched PV lines are sent using a previous search score.
+/// If 'sent' is given, it keeps a signature of each line as last sent, and the
+/// lines with the same depth, score, bound and moves are left out.
 
-string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
+string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta,
+               std::vector<Key>* sent) {
 
   std::stringstream ss;
   TimePoint elapsed = Time.elapsed() + 1;
   const RootMoves& rootMoves = pos.this_thread()->rootMoves;
   size_t pvIdx = pos.this_thread()->pvIdx;
-  size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
-  uint64_t nodesSearched = Threads.nodes_searched();
+  size_t multiPV = pos.this_thread()->multiPV;
+  uint64_t nodesSearched = Threads.nodes_searched() + Cluster::nodes_searched();
   uint64_t tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+  int hashfull = elapsed > 1000 ? TT.hashfull() : 0; // Earlier makes little sense
+
+  if (sent)
+      sent->resize(multiPV);
 
   for (size_t i = 0; i < multiPV; ++i)
   {
@@ -1669,6 +2026,21 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
       bool tb = TB::RootInTB && abs(v) < VALUE_MATE - MAX_PLY;
       v = tb ? rootMoves[i].tbScore : v;
 
+      const char* bound =  tb || i != pvIdx ? ""
+                         : v >= beta ? " lowerbound" : v <= alpha ? " upperbound" : "";
+
+      if (sent)
+      {
+          Key sig = (Key(d) << 32) ^ Key(v - VALUE_INFINITE) ^ Key(*bound ? bound[1] : 0) << 48;
+          for (Move m : rootMoves[i].pv)
+              sig = sig * 6364136223846793005ULL + m;
+
+          if ((*sent)[i] == sig)
+              continue;
+
+          (*sent)[i] = sig;
+      }
+
       if (ss.rdbuf()->in_avail()) // Not at first line
           ss << "\n";
 
@@ -1676,16 +2048,13 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
          << " depth "    << d / ONE_PLY
          << " seldepth " << rootMoves[i].selDepth
          << " multipv "  << i + 1
-         << " score "    << UCI::value(v);
-
-      if (!tb && i == pvIdx)
-          ss << (v >= beta ? " lowerbound" : v <= alpha ? " upperbound" : "");
+         << " score "    << UCI::value(v) << bound;
 
       ss << " nodes "    << nodesSearched
          << " nps "      << nodesSearched * 1000 / elapsed;
 
-      if (elapsed > 1000) // Earlier makes little sense
-          ss << " hashfull " << TT.hashfull();
+      if (elapsed > 1000)
+          ss << " hashfull " << hashfull;
 
       ss << " tbhits "   << tbHits
          << " time "     << elapsed
@@ -1736,6 +2105,8 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
     Cardinality = int(Options["SyzygyProbeLimit"]);
     bool dtz_available = true;
 
+    prefetch(pos);
+
     // Tables with fewer pieces than SyzygyProbeLimit are searched with
     // ProbeDepth == DEPTH_ZERO
     if (Cardinality > MaxCardinality)
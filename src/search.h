@@ -77,6 +77,16 @@ struct RootMove {
 typedef std::vector<RootMove> RootMoves;
 
 
+/// ZugzwangEntry caches the outcome of the zugzwang verification done by the
+/// null move search, so that transpositions do not repeat it.
+
+struct ZugzwangEntry {
+  Key key;
+  int16_t depth;
+  bool mate;
+};
+
+
 /// LimitsType struct stores information sent by GUI about available time to
 /// search the current move, maximum depth/time, or if we are in analysis mode.
 
@@ -86,6 +96,7 @@ struct LimitsType {
     time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = TimePoint(0);
     movestogo = depth = mate = perft = infinite = 0;
     nodes = 0;
+    silent = false;
   }
 
   bool use_time_management() const {
@@ -96,6 +107,7 @@ struct LimitsType {
   TimePoint time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, startTime;
   int movestogo, depth, mate, perft, infinite;
   int64_t nodes;
+  bool silent; // No info and bestmove output nor book, the caller reports the result
 };
 
 extern LimitsType Limits;
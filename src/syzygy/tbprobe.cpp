@@ -26,13 +26,16 @@
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include <type_traits>
 
 #include "../bitboard.h"
 #include "../movegen.h"
 #include "../position.h"
 #include "../search.h"
+#include "../thread.h"
 #include "../thread_win32.h"
 #include "../types.h"
 #include "../uci.h"
@@ -312,6 +315,7 @@ struct TBTable {
     static constexpr int Sides = Type == WDL ? 2 : 1;
 
     std::atomic_bool ready;
+    Mutex mutex; // Serializes the lazy mapping of this table only
     void* baseAddress;
     uint8_t* map;
     uint64_t mapping;
@@ -321,6 +325,7 @@ struct TBTable {
     bool hasPawns;
     bool hasUniquePieces;
     uint8_t pawnCount[2]; // [Lead color / other color]
+    uint8_t pieceNum[COLOR_NB][PIECE_TYPE_NB]; // [Side with key / side with key2][...]
     PairsData items[Sides][4]; // [wtm / btm][FILE_A..FILE_D or 0]
 
     PairsData* get(int stm, int f) {
@@ -362,6 +367,10 @@ TBTable<WDL>::TBTable(const std::string& code) : TBTable() {
     pawnCount[0] = pos.count<PAWN>(c ? WHITE : BLACK);
     pawnCount[1] = pos.count<PAWN>(c ? BLACK : WHITE);
 
+    for (Color c2 = WHITE; c2 <= BLACK; ++c2)
+        for (PieceType pt = NO_PIECE_TYPE; pt < PIECE_TYPE_NB; ++pt)
+            pieceNum[c2][pt] = uint8_t(popcount(pos.pieces(c2, pt)));
+
     key2 = pos.set(code, BLACK, &st).material_key();
 }
 
@@ -376,6 +385,7 @@ TBTable<DTZ>::TBTable(const TBTable<WDL>& wdl) : TBTable() {
     hasUniquePieces = wdl.hasUniquePieces;
     pawnCount[0] = wdl.pawnCount[0];
     pawnCount[1] = wdl.pawnCount[1];
+    std::memcpy(pieceNum, wdl.pieceNum, sizeof(pieceNum));
 }
 
 // class TBTables creates and keeps ownership of the TBTable objects, one for
@@ -434,6 +444,12 @@ public:
     }
     size_t size() const { return wdlTable.size(); }
     void add(const std::vector<PieceType>& pieces);
+
+    // Call f(wdl, dtz) for each pair of tables
+    template<typename F> void for_each(F f) {
+        for (size_t i = 0; i < wdlTable.size(); ++i)
+            f(wdlTable[i], dtzTable[i]);
+    }
 };
 
 TBTables TBTables;
@@ -1098,56 +1114,298 @@ void set(T& e, uint8_t* data) {
         }
 }
 
-// If the TB file corresponding to the given position is already memory mapped
-// then return its base address, otherwise try to memory map and init it. Called
-// at every probe, memory map and init only at first access. Function is thread
-// safe and can be called concurrently.
-template<TBType Type>
-void* mapped(TBTable<Type>& e, const Position& pos) {
+// Ask the OS to read ahead the sparse index and the block length tables of a
+// just mapped file, they are touched by every probe. With 'touch' the pages
+// are also faulted in, so that the probing thread does not stall on them.
+template<typename T>
+void advise(T& e, bool touch) {
 
-    static Mutex mutex;
+    const int sides = T::Sides == 2 && (e.key != e.key2) ? 2 : 1;
+    const File maxFile = e.hasPawns ? FILE_D : FILE_A;
+
+    auto readahead = [touch](const void* addr, size_t len) {
+#ifndef _WIN32
+        constexpr uintptr_t PageSize = 4096;
+        uintptr_t start = (uintptr_t)addr & ~(PageSize - 1);
+        madvise((void*)start, (uintptr_t)addr + len - start, MADV_WILLNEED);
+#endif
+        if (touch)
+        {
+            volatile uint8_t sink = 0;
+            for (size_t i = 0; i < len; i += 4096)
+                sink = sink + ((const uint8_t*)addr)[i];
+        }
+    };
+
+    for (File f = FILE_A; f <= maxFile; ++f)
+        for (int i = 0; i < sides; i++) {
+            PairsData* d = e.get(i, f);
+            readahead(d->sparseIndex, d->sparseIndexSize * sizeof(SparseEntry));
+            readahead(d->blockLength, d->blockLengthSize * sizeof(uint16_t));
+        }
+}
+
+// If the TB file of the given table is already memory mapped then return its
+// base address, otherwise try to memory map and init it. Called at every probe
+// and by the prefetch thread, memory map and init only at first access. Function
+// is thread safe and can be called concurrently, only threads mapping the same
+// table wait for each other.
+template<TBType Type>
+void* mapped(TBTable<Type>& e, bool touch = false) {
 
     // Use 'aquire' to avoid a thread reads 'ready' == true while another is
     // still working, this could happen due to compiler reordering.
     if (e.ready.load(std::memory_order_acquire))
         return e.baseAddress; // Could be nullptr if file does not exsist
 
-    std::unique_lock<Mutex> lk(mutex);
+    std::unique_lock<Mutex> lk(e.mutex);
 
     if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
         return e.baseAddress;
 
-    // Pieces strings in decreasing order for each color, like ("KPP","KR")
+    // Pieces strings in decreasing order for each side, like ("KPP","KR"), the
+    // side of e.key first like in the file name.
     std::string fname, w, b;
     for (PieceType pt = KING; pt >= PAWN; --pt) {
-        w += std::string(popcount(pos.pieces(WHITE, pt)), PieceToChar[pt]);
-        b += std::string(popcount(pos.pieces(BLACK, pt)), PieceToChar[pt]);
+        w += std::string(e.pieceNum[WHITE][pt], PieceToChar[pt]);
+        b += std::string(e.pieceNum[BLACK][pt], PieceToChar[pt]);
     }
 
-    fname =  (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w)
-           + (Type == WDL ? ".rtbw" : ".rtbz");
+    fname = w + 'v' + b + (Type == WDL ? ".rtbw" : ".rtbz");
 
     uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
 
     if (data)
+    {
         set(e, data);
+        advise(e, touch);
+    }
 
     e.ready.store(true, std::memory_order_release);
     return e.baseAddress;
 }
 
+// class Prefetcher maps in a background thread the tables that can be reached
+// from the root position, so that search threads do not block on disk I/O at
+// the first probe of a table in an endgame transition.
+class Prefetcher {
+
+    std::thread th;
+    std::atomic_bool stop;
+    Key lastKey = 0;
+
+public:
+    Prefetcher() : stop(false) {}
+   ~Prefetcher() { wait(); }
+
+    void wait() {
+        stop = true;
+        if (th.joinable())
+            th.join();
+        stop = false;
+        lastKey = 0;
+    }
+
+    void start(const Position& pos);
+};
+
+Prefetcher TBPrefetcher; // Defined after TBTables, so destroyed before it
+
+// Tables with up to the given number of pieces more than SyzygyProbeLimit are
+// prefetched, they are a few captures away.
+constexpr int PrefetchMargin = 2;
+
+// True if the table pieces are a subset of the position ones, counting the
+// promotions that the spare pawns of each side could make.
+template<TBType Type>
+bool reachable(const TBTable<Type>& e, const Position& pos, Color us) {
+
+    for (int s = 0; s < 2; ++s)
+    {
+        Color c = s ? ~us : us;
+        int spare = popcount(pos.pieces(c, PAWN)) - e.pieceNum[s][PAWN];
+
+        for (PieceType pt = KNIGHT; pt <= QUEEN && spare >= 0; ++pt)
+            spare -= std::max(0, e.pieceNum[s][pt] - popcount(pos.pieces(c, pt)));
+
+        if (spare < 0)
+            return false;
+    }
+    return true;
+}
+
+void Prefetcher::start(const Position& pos) {
+
+    int limit = std::min(int(Options["SyzygyProbeLimit"]), MaxCardinality);
+
+    if (   pos.material_key() == lastKey
+        || popcount(pos.pieces()) > limit + PrefetchMargin)
+        return;
+
+    wait();
+    lastKey = pos.material_key();
+
+    std::vector<std::pair<TBTable<WDL>*, TBTable<DTZ>*>> tables;
+
+    TBTables.for_each([&](TBTable<WDL>& wdl, TBTable<DTZ>& dtz) {
+        if (   wdl.pieceCount <= limit
+            && !dtz.ready.load(std::memory_order_relaxed)
+            && (reachable(wdl, pos, WHITE) || reachable(wdl, pos, BLACK)))
+            tables.emplace_back(&wdl, &dtz);
+    });
+
+    if (tables.empty())
+        return;
+
+    // Bigger tables first, these are the ones probed soon after the root
+    std::stable_sort(tables.begin(), tables.end(), [](const std::pair<TBTable<WDL>*, TBTable<DTZ>*>& a,
+                                                      const std::pair<TBTable<WDL>*, TBTable<DTZ>*>& b) {
+        return a.first->pieceCount > b.first->pieceCount;
+    });
+
+    th = std::thread([this, tables]() {
+        for (auto& t : tables)
+        {
+            if (stop)
+                break;
+
+            mapped(*t.first, true);
+            mapped(*t.second, true);
+        }
+    });
+}
+
+// ProbeCache keeps the results of probe_table() so that positions probed again,
+// by the same or by another thread, do not decompress the table data, which
+// may have to be read from a slow disk first. A slot is a single 64 bit word
+// with the upper key bits, a valid flag, the probe state and the value, so it
+// is read and written atomically without any lock.
+class ProbeCache {
+
+    static constexpr uint64_t KeyMask = ~uint64_t(0) << 24;
+    static constexpr uint64_t Valid   = uint64_t(1) << 23;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> table;
+    size_t mask = 0;
+
+public:
+    void resize(size_t mbSize) {
+        size_t count = pow2_count(mbSize, sizeof(uint64_t));
+
+        table.reset(count ? new std::atomic<uint64_t>[count]() : nullptr);
+        mask = count ? count - 1 : 0;
+    }
+
+    bool probe(Key key, int& value, ProbeState& state) const {
+        if (!table)
+            return false;
+
+        uint64_t data = table[key & mask].load(std::memory_order_relaxed);
+
+        if (!(data & Valid) || (data & KeyMask) != (key & KeyMask))
+            return false;
+
+        value = int16_t(data & 0xFFFF);
+        state = ProbeState(int((data >> 16) & 0x7) - 1);
+        return true;
+    }
+
+    void store(Key key, int value, ProbeState state) {
+        if (table)
+            table[key & mask].store(  (key & KeyMask) | Valid
+                                    | uint64_t(state + 1) << 16 | uint16_t(value),
+                                    std::memory_order_relaxed);
+    }
+};
+
+ProbeCache TBCache;
+
+// RootCache keeps the probe values of the moves of the last root positions
+// ranked, so that a root ranked again, after a 'stop' or ahead of time by
+// prefetch_roots(), needs no probe at all. The values are those of the
+// positions after the moves, which do not depend on the moves played to reach
+// the root, so they are keyed by the root key alone. Used by one thread at a
+// time, the one ranking the root moves.
+class RootCache {
+
+    static constexpr size_t Size = 64;
+
+    struct Entry {
+        Key key = 0;
+        std::vector<std::pair<Move, int>> values;
+    };
+
+    Entry table[Size];
+
+public:
+    void clear() { std::fill(std::begin(table), std::end(table), Entry()); }
+
+    bool probe(Key key, const Search::RootMoves& rootMoves, std::vector<int>& values) const {
+        const Entry& e = table[key % Size];
+
+        if (e.key != key)
+            return false;
+
+        values.clear();
+        for (const auto& m : rootMoves)
+        {
+            auto it = std::find_if(e.values.begin(), e.values.end(),
+                                   [&](const std::pair<Move, int>& v) { return v.first == m.pv[0]; });
+            if (it == e.values.end())
+                return false;
+
+            values.push_back(it->second);
+        }
+        return true;
+    }
+
+    void store(Key key, const Search::RootMoves& rootMoves, const std::vector<int>& values) {
+        Entry& e = table[key % Size];
+
+        e.key = key;
+        e.values.clear();
+        for (size_t i = 0; i < rootMoves.size(); ++i)
+            e.values.emplace_back(rootMoves[i].pv[0], values[i]);
+    }
+};
+
+RootCache TBRootCache;
+
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
 Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
     if (pos.count<ALL_PIECES>() == 2) // KvK
         return Ret(WDLDraw);
 
+    // A DTZ value depends also on the WDL score it is decoded for
+    Key key = pos.key() ^ (Type == DTZ ? 0x9E3779B97F4A7C15ULL * (wdl + 3) : 0);
+    Thread* th = pos.this_thread();
+    int value;
+    ProbeState state;
+
+    th->tbCacheProbes.fetch_add(1, std::memory_order_relaxed);
+
+    if (TBCache.probe(key, value, state))
+    {
+        th->tbCacheHits.fetch_add(1, std::memory_order_relaxed);
+
+        if (state == CHANGE_STM)
+            *result = CHANGE_STM;
+
+        return Ret(value);
+    }
+
     TBTable<Type>* entry = TBTables.get<Type>(pos.material_key());
 
-    if (!entry || !mapped(*entry, pos))
+    if (!entry || !mapped(*entry))
         return *result = FAIL, Ret();
 
-    return do_probe_table(pos, entry, wdl, result);
+    Ret ret = do_probe_table(pos, entry, wdl, result);
+
+    if (*result != FAIL)
+        TBCache.store(key, int(ret), *result == CHANGE_STM ? CHANGE_STM : OK);
+
+    return ret;
 }
 
 // For a position where the side to move has a winning capture it is not necessary
@@ -1229,11 +1487,18 @@ WDLScore search(Position& pos, ProbeState* result) {
 
 
 /// Tablebases::init() is called at startup and after every change to
-/// "SyzygyPath" UCI option to (re)create the various tables. It is not thread
-/// safe, nor it needs to be.
+/// "SyzygyPath" UCI option to (re)create the various tables. It first stops
+/// and waits for the probes of prefetch_roots(), which the main thread may be
+/// doing after a search, then it has the tables to itself.
 void Tablebases::init(const std::string& paths) {
 
+    if (!Threads.empty())
+        Threads.wait_for_main();
+
+    TBPrefetcher.wait();
     TBTables.clear();
+    TBCache.resize(0);
+    TBRootCache.clear();
     MaxCardinality = 0;
     TBFile::Paths = paths;
 
@@ -1372,9 +1637,33 @@ void Tablebases::init(const std::string& paths) {
         }
     }
 
+    resize_cache(Options["SyzygyCache"]);
+
     sync_cout << "info string Found " << TBTables.size() << " tablebases" << sync_endl;
 }
 
+
+/// Tablebases::prefetch() starts mapping in the background the tables that can
+/// be reached from the given root position, when this is close enough to the
+/// SyzygyProbeLimit. Called by the main thread only.
+void Tablebases::prefetch(const Position& pos) {
+
+    if (MaxCardinality)
+        TBPrefetcher.start(pos);
+}
+
+
+/// Tablebases::resize_cache() sets the size in MB of the cache of probe
+/// results. It is allocated only when tablebases are in use. It waits for the
+/// probes of prefetch_roots() to stop first, as init() does.
+void Tablebases::resize_cache(size_t mbSize) {
+
+    if (!Threads.empty())
+        Threads.wait_for_main();
+
+    TBCache.resize(MaxCardinality ? mbSize : 0);
+}
+
 // Probe the WDL table for a particular position.
 // If *result != FAIL, the probe was successful.
 // The return value is from the point of view of the side to move:
@@ -1478,52 +1767,136 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 }
 
 
-// Use the DTZ tables to rank root moves.
-//
-// A return value false indicates that not all probes were successful.
-bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
+namespace {
+
+// Probe the position after a root move. With DTZ tables the value is the dtz
+// of the move counting from the root position, with WDL tables the WDL score
+// of the move.
+template<TBType Type>
+int probe_root_move(Position& pos, Move m, ProbeState* result) {
 
-    ProbeState result;
     StateInfo st;
+    int v;
 
-    // Obtain 50-move counter for the root position
-    int cnt50 = pos.rule50_count();
+    pos.do_move(m, st);
 
-    // Check whether a position was repeated since the last zeroing move.
-    bool rep = pos.has_repeated();
+    if (Type == WDL)
+        v = -probe_wdl(pos, result);
 
-    int dtz, bound = Options["Syzygy50MoveRule"] ? 900 : 1;
+    else if (pos.rule50_count() == 0)
+    {
+        // In case of a zeroing move, dtz is one of -101/-1/0/1/101
+        WDLScore wdl = -probe_wdl(pos, result);
+        v = dtz_before_zeroing(wdl);
+    }
+    else
+    {
+        // Otherwise, take dtz for the new position and correct by 1 ply
+        v = -probe_dtz(pos, result);
+        v =  v > 0 ? v + 1
+           : v < 0 ? v - 1 : v;
+    }
+
+    // Make sure that a mating move is assigned a dtz value of 1
+    if (   Type == DTZ
+        && pos.checkers()
+        && v == 2
+        && MoveList<LEGAL>(pos).size() == 0)
+        v = 1;
+
+    pos.undo_move(m);
+    return v;
+}
+
+// Probe all the root moves, or take their values from TBRootCache. Before a
+// search the probes are spread over the threads of the pool, each one taking
+// the next move to probe so that a probe reading a cold table does not hold
+// up the others. Otherwise they are done by the calling thread, and given up
+// once the pool is needed. A return value false indicates that not all probes
+// were done or successful.
+template<TBType Type>
+bool probe_root_moves(Position& pos, const Search::RootMoves& rootMoves,
+                      std::vector<int>& values, bool parallel) {
+
+    Key key = pos.key() ^ (Type == DTZ ? 0x9E3779B97F4A7C15ULL : 0);
+
+    if (TBRootCache.probe(key, rootMoves, values))
+        return true;
 
-    // Probe and rank each move
-    for (auto& m : rootMoves)
+    values.assign(rootMoves.size(), 0);
+
+    if (!parallel)
     {
-        pos.do_move(m.pv[0], st);
+        ProbeState result;
 
-        // Calculate dtz for the current move counting from the root position
-        if (pos.rule50_count() == 0)
-        {
-            // In case of a zeroing move, dtz is one of -101/-1/0/1/101
-            WDLScore wdl = -probe_wdl(pos, &result);
-            dtz = dtz_before_zeroing(wdl);
-        }
-        else
+        for (size_t i = 0; i < rootMoves.size(); ++i)
         {
-            // Otherwise, take dtz for the new position and correct by 1 ply
-            dtz = -probe_dtz(pos, &result);
-            dtz =  dtz > 0 ? dtz + 1
-                 : dtz < 0 ? dtz - 1 : dtz;
+            values[i] = probe_root_move<Type>(pos, rootMoves[i].pv[0], &result);
+
+            if (result == FAIL || Threads.stopPrefetch)
+                return false;
         }
+    }
+    else
+    {
+        std::atomic<size_t> next(0);
+        std::atomic_bool failed(false);
+        std::string fen = pos.fen();
+
+        for (Thread* th : Threads)
+            th->start_job([&, th]() {
+                Position p;
+                StateInfo st;
+                ProbeState result;
 
-        // Make sure that a mating move is assigned a dtz value of 1
-        if (   pos.checkers()
-            && dtz == 2
-            && MoveList<LEGAL>(pos).size() == 0)
-            dtz = 1;
+                p.set(fen, pos.is_chess960(), &st, th);
 
-        pos.undo_move(m.pv[0]);
+                for (size_t i; !failed && (i = next++) < rootMoves.size(); )
+                {
+                    values[i] = probe_root_move<Type>(p, rootMoves[i].pv[0], &result);
+
+                    if (result == FAIL)
+                        failed = true;
+                }
+            });
 
-        if (result == FAIL)
+        for (Thread* th : Threads)
+            th->wait_for_search_finished();
+
+        if (failed)
             return false;
+    }
+
+    TBRootCache.store(key, rootMoves, values);
+    return true;
+}
+
+} // namespace
+
+
+// Use the DTZ tables to rank root moves.
+//
+// A return value false indicates that not all probes were successful.
+bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
+
+    std::vector<int> dtzs;
+
+    if (!probe_root_moves<DTZ>(pos, rootMoves, dtzs, true))
+        return false;
+
+    // Obtain 50-move counter for the root position
+    int cnt50 = pos.rule50_count();
+
+    // Check whether a position was repeated since the last zeroing move.
+    bool rep = pos.has_repeated();
+
+    int bound = Options["Syzygy50MoveRule"] ? 900 : 1;
+
+    // Rank each move
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        auto& m = rootMoves[i];
+        int dtz = dtzs[i];
 
         // Better moves are ranked higher. Certain wins are ranked equally.
         // Losing moves are ranked equally unless a 50-move draw is in sight.
@@ -1554,22 +1927,18 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves) {
 
     static const int WDL_to_rank[] = { -1000, -899, 0, 899, 1000 };
 
-    ProbeState result;
-    StateInfo st;
+    std::vector<int> wdls;
+
+    if (!probe_root_moves<WDL>(pos, rootMoves, wdls, true))
+        return false;
 
     bool rule50 = Options["Syzygy50MoveRule"];
 
-    // Probe and rank each move
-    for (auto& m : rootMoves)
+    // Rank each move
+    for (size_t i = 0; i < rootMoves.size(); ++i)
     {
-        pos.do_move(m.pv[0], st);
-
-        WDLScore wdl = -probe_wdl(pos, &result);
-
-        pos.undo_move(m.pv[0]);
-
-        if (result == FAIL)
-            return false;
+        auto& m = rootMoves[i];
+        WDLScore wdl = WDLScore(wdls[i]);
 
         m.tbRank = WDL_to_rank[wdl + 2];
 
@@ -1581,3 +1950,49 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves) {
 
     return true;
 }
+
+
+/// Tablebases::prefetch_roots() ranks ahead of time, while the opponent thinks,
+/// the root positions after the given move and each reply, the expected reply
+/// first, so that the next search finds the ranks in TBRootCache. Called by
+/// the main thread after a search, it gives up as soon as the pool is needed.
+void Tablebases::prefetch_roots(Position& pos, Move best, Move ponder) {
+
+    int limit = std::min(int(Options["SyzygyProbeLimit"]), MaxCardinality);
+
+    if (!best || popcount(pos.pieces()) > limit + 2)
+        return;
+
+    StateInfo st[2];
+    std::vector<Move> replies;
+    std::vector<int> values;
+
+    pos.do_move(best, st[0]);
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+        replies.insert(m == ponder ? replies.begin() : replies.end(), m);
+
+    for (Move r : replies)
+    {
+        if (Threads.stopPrefetch)
+            break;
+
+        pos.do_move(r, st[1]);
+
+        if (popcount(pos.pieces()) <= limit && !pos.can_castle(ANY_CASTLING))
+        {
+            Search::RootMoves rootMoves;
+            for (const auto& m : MoveList<LEGAL>(pos))
+                rootMoves.emplace_back(m);
+
+            if (   !rootMoves.empty()
+                && !probe_root_moves<DTZ>(pos, rootMoves, values, false)
+                && !Threads.stopPrefetch)
+                probe_root_moves<WDL>(pos, rootMoves, values, false);
+        }
+
+        pos.undo_move(r);
+    }
+
+    pos.undo_move(best);
+}
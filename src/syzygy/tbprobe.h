@@ -48,11 +48,14 @@ enum ProbeState {
 extern int MaxCardinality;
 
 void init(const std::string& paths);
+void resize_cache(size_t mbSize);
+void prefetch(const Position& pos);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
 void rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+void prefetch_roots(Position& pos, Move best, Move ponder);
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
@@ -20,6 +20,9 @@
 
 #include <algorithm> // For std::count
 #include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
 
 #include "movegen.h"
 #include "search.h"
@@ -30,6 +33,10 @@
 
 ThreadPool Threads; // Global object
 
+#if defined(CONTHIST_SHARED)
+ContinuationHistory Thread::continuationHistory;
+#endif
+
 
 /// Thread constructor launches the thread and waits until it goes to sleep
 /// in idle_loop(). Note that 'searching' and 'exit' should be alredy set.
@@ -53,15 +60,47 @@ Thread::~Thread() {
 }
 
 
-/// Thread::clear() reset histories, usually before a new game
+/// Thread::clear() reset histories, usually before a new game. They are only
+/// written by search(), so they are left as they are if the thread has not
+/// searched since the last clear(), as with unused threads in bullet games.
 
 void Thread::clear() {
 
+  pawnsTable.resize(size_t(Options["PawnTableSize"]));
+  materialTable.resize(size_t(Options["MaterialTableSize"]));
+  useEvalCache = int(Options["EvalCacheSize"]) > 0;
+  evalCache.resize(size_t(Options["EvalCacheSize"]));
+
+#if defined(CONTHIST_SHARED)
+  // Any thread may have written the shared table, the main thread clears it
+  if (idx == 0)
+      clear_continuation_history();
+#endif
+
+  if (cleared)
+      return;
+
+  cleared = true;
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
   captureHistory.fill(0);
+  zugzwangTable.clear(); // Its verdicts depend on the TT and the histories
+
+#if !defined(CONTHIST_SHARED)
+  clear_continuation_history();
+#endif
 
-  for (auto& to : continuationHistory)
+  std::fill(std::begin(stats), std::end(stats), 0);
+}
+
+
+/// Thread::clear_continuation_history() resets the continuation history. The
+/// entry for NO_PIECE is the sentinel of the moves before the root and after
+/// a null move, see CounterMovePruneThreshold.
+
+void Thread::clear_continuation_history() {
+
+  for (auto& to : continuationHistory.table)
       for (auto& h : to)
           h->fill(0);
 
@@ -78,6 +117,32 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::start_clearing() wakes up the thread to run clear() instead of a
+/// search, so that the threads of the pool clear their tables in parallel, each
+/// one on the NUMA node it is bound to. Use wait_for_search_finished() to wait
+/// for it to be done.
+
+void Thread::start_clearing() {
+
+  std::lock_guard<Mutex> lk(mutex);
+  clearing = searching = true;
+  cv.notify_one();
+}
+
+
+/// Thread::start_job() wakes up the thread to run the given function instead
+/// of a search, as for the probes of the root moves spread over the pool. Use
+/// wait_for_search_finished() to wait for it to be done.
+
+void Thread::start_job(std::function<void()> f) {
+
+  std::lock_guard<Mutex> lk(mutex);
+  job = std::move(f);
+  searching = true;
+  cv.notify_one();
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
 /// until the thread has finished searching.
 
@@ -111,9 +176,20 @@ void Thread::idle_loop() {
       if (exit)
           return;
 
+      bool clear_only = clearing;
+      std::function<void()> task = std::move(job);
+      clearing = false;
+      job = nullptr;
+      cleared = cleared && (clear_only || task);
+
       lk.unlock();
 
-      search();
+      if (clear_only)
+          clear();
+      else if (task)
+          task();
+      else
+          search();
   }
 }
 
@@ -124,34 +200,74 @@ void Thread::idle_loop() {
 void ThreadPool::set(size_t requested) {
 
   if (size() > 0) { // destroy any existing thread(s)
-      main()->wait_for_search_finished();
+      wait_for_main();
 
       while (size() > 0)
           delete back(), pop_back();
   }
 
   if (requested > 0) { // create new thread(s)
-      push_back(new MainThread(0));
-
       while (size() < requested)
-          push_back(new Thread(size()));
+      {
+          size_t idx = size();
+          auto create = [idx]() -> Thread* { return idx ? new Thread(idx) : new MainThread(idx); };
+
+          // With thread binding, allocate each Thread from a thread bound the
+          // same way its search thread will be. The tables written by the
+          // constructor are then first touched, and so placed, on the NUMA node
+          // where they are going to be used. clear() below runs in the search
+          // threads, which are bound already.
+          if (requested >= 8)
+          {
+              Thread* th = nullptr;
+              std::thread([&]() {
+                  WinProcGroup::bindThisThread(idx);
+                  th = create();
+              }).join();
+              push_back(th);
+          }
+          else
+              push_back(create());
+      }
       clear();
+
+      std::string topology = WinProcGroup::topology();
+      if (requested >= 8 && !topology.empty())
+          sync_cout << "info string Thread binding on " << topology
+                    << " for " << requested << " threads" << sync_endl;
   }
 
   // Reallocate the hash with the new threadpool size
   TT.resize(Options["Hash"]);
 }
 
-/// ThreadPool::clear() sets threadPool data to initial values.
+/// ThreadPool::clear() sets threadPool data to initial values. Each thread
+/// clears its own tables, all of them at the same time.
 
 void ThreadPool::clear() {
 
+  wait_for_main();
+
   for (Thread* th : *this)
-      th->clear();
+      th->start_clearing();
+
+  for (Thread* th : *this)
+      th->wait_for_search_finished();
 
   main()->callsCnt = 0;
   main()->previousScore = VALUE_INFINITE;
   main()->previousTimeReduction = 1.0;
+  main()->previousDepth = DEPTH_ZERO;
+}
+
+/// ThreadPool::wait_for_main() waits for the main thread to be idle. It first
+/// stops the ranking of the next root positions that the main thread may be
+/// doing after a search, see Tablebases::prefetch_roots().
+
+void ThreadPool::wait_for_main() {
+
+  stopPrefetch = true;
+  main()->wait_for_search_finished();
 }
 
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
@@ -160,9 +276,9 @@ void ThreadPool::clear() {
 void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
                                 const Search::LimitsType& limits, bool ponderMode) {
 
-  main()->wait_for_search_finished();
+  wait_for_main();
 
-  stopOnPonderhit = stop = false;
+  stopOnPonderhit = stop = stopPrefetch = false;
   ponder = ponderMode;
   Search::Limits = limits;
   Search::RootMoves rootMoves;
@@ -186,18 +302,85 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
   // be deduced from a fen string, so set() clears them and to not lose the info
   // we need to backup and later restore setupStates->back(). Note that setupStates
-  // is shared by threads but is accessed in read-only mode.
+  // is shared by threads but is accessed in read-only mode, so only those fields
+  // are restored to keep the check info that set() computes.
   StateInfo tmp = setupStates->back();
 
   for (Thread* th : *this)
   {
-      th->nodes = th->tbHits = th->nmpMinPly = 0;
+      th->nodes = th->tbHits = th->ttHits = th->nmpMinPly = 0;
+      th->tbCacheProbes = th->tbCacheHits = 0;
+      th->zugzwangNodes = 0;
       th->rootDepth = th->completedDepth = DEPTH_ZERO;
       th->rootMoves = rootMoves;
       th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
   }
 
-  setupStates->back() = tmp;
+  setupStates->back().previous = tmp.previous;
+  setupStates->back().pliesFromNull = tmp.pliesFromNull;
+  setupStates->back().capturedPiece = tmp.capturedPiece;
 
   main()->start_searching();
 }
+
+
+/// ThreadPool::stats() sums the search counters of all the threads since the
+/// last clear() and formats them with their rates.
+
+std::string ThreadPool::stats() const {
+
+  // The tablebase cache counters are always collected, they are cheap
+  // compared to a tablebase probe.
+  std::stringstream ss;
+  uint64_t tbProbes = tb_cache_probes(), tbHitCount = tb_cache_hits();
+
+  ss << "info string " << std::left << std::setw(15) << "TB cache" << std::right
+     << std::setw(13) << tbProbes << "  hits " << tbHitCount
+     << " (" << std::fixed << std::setprecision(1)
+     << (tbProbes ? 100.0 * tbHitCount / tbProbes : 0.0) << "%)\n";
+
+#ifndef SEARCH_STATS
+  ss << "info string Search statistics not compiled in, build with stats=yes";
+  return ss.str();
+#else
+  uint64_t sum[STAT_NB] = {};
+
+  for (Thread* th : *this)
+      for (int c = 0; c < STAT_NB; ++c)
+          sum[c] += th->stats[c];
+
+  auto line = [&](const char* name, StatCounter total, StatCounter part, const char* partName) {
+      ss << "\ninfo string " << std::left << std::setw(15) << name << std::right
+         << std::setw(13) << sum[total] << "  " << partName << " " << sum[part]
+         << " (" << std::fixed << std::setprecision(1)
+         << (sum[total] ? 100.0 * sum[part] / sum[total] : 0.0) << "%)";
+  };
+
+  auto count = [&](const char* name, StatCounter c) {
+      ss << "\ninfo string " << std::left << std::setw(15) << name << std::right
+         << std::setw(13) << sum[c];
+  };
+
+  ss << "info string Search statistics of " << size() << " threads";
+  line("TT probes",      STAT_TT_PROBE,       STAT_TT_HIT,         "hits");
+  line("TT hits",        STAT_TT_HIT,         STAT_TT_CUT,         "cutoffs");
+  line("TT hits",        STAT_TT_HIT,         STAT_TT_BAD_MOVE,    "bad moves");
+  line("Null moves",     STAT_NULL_TRY,       STAT_NULL_CUT,       "fail high");
+  line("Zugzwang",       STAT_ZUGZWANG_PROBE, STAT_ZUGZWANG_MATE,  "mates");
+  line("ProbCut",        STAT_PROBCUT_TRY,    STAT_PROBCUT_CUT,    "cutoffs");
+  line("LMR",            STAT_LMR,            STAT_LMR_RESEARCH,   "re-searches");
+  line("Beta cutoffs",   STAT_CUTOFF,         STAT_CUTOFF_FIRST,   "first move");
+  line("Eval cache",     STAT_EVAL_CACHE_PROBE, STAT_EVAL_CACHE_HIT, "hits");
+  line("Evaluations",    STAT_EVAL,           STAT_EVAL_LAZY,      "lazy exits");
+  line("Pawn probes",    STAT_PAWN_PROBE,     STAT_PAWN_HIT,       "hits");
+  line("Shared pawns",   STAT_PAWN_PROBE,     STAT_PAWN_SHARED_HIT, "hits");
+  line("Material",       STAT_MATERIAL_PROBE, STAT_MATERIAL_HIT,   "hits");
+  count("TT torn entries", STAT_TT_TORN);
+  count("Zugzwang cached", STAT_ZUGZWANG_CACHED);
+  count("Zugzwang nodes",  STAT_ZUGZWANG_NODES);
+  count("QSearch nodes",   STAT_QS_NODE);
+  count("SEE calls",       STAT_SEE);
+
+  return ss.str();
+#endif
+}
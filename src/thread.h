@@ -23,10 +23,12 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
@@ -35,6 +37,30 @@
 #include "thread_win32.h"
 
 
+/// StatCounter lists the search events counted per thread in builds with
+/// stats=yes (SEARCH_STATS), see ThreadPool::stats(). Each thread writes only
+/// its own counters, so they are plain integers summed once the search is
+/// over, and the whole instrumentation compiles to nothing otherwise.
+
+enum StatCounter {
+  STAT_TT_PROBE, STAT_TT_HIT, STAT_TT_CUT, STAT_TT_BAD_MOVE, STAT_TT_TORN,
+  STAT_NULL_TRY, STAT_NULL_CUT, STAT_ZUGZWANG_PROBE, STAT_ZUGZWANG_MATE,
+  STAT_ZUGZWANG_CACHED, STAT_ZUGZWANG_NODES,
+  STAT_PROBCUT_TRY, STAT_PROBCUT_CUT, STAT_LMR, STAT_LMR_RESEARCH, STAT_CUTOFF, STAT_CUTOFF_FIRST,
+  STAT_QS_NODE, STAT_SEE, STAT_EVAL, STAT_EVAL_LAZY, STAT_EVAL_CACHE_PROBE, STAT_EVAL_CACHE_HIT,
+  STAT_PAWN_PROBE, STAT_PAWN_HIT, STAT_PAWN_SHARED_HIT, STAT_MATERIAL_PROBE, STAT_MATERIAL_HIT,
+  STAT_NB
+};
+
+#ifdef SEARCH_STATS
+#define STATS_INC(th, c) (++(th)->stats[c])
+#define STATS_ADD(th, c, n) ((th)->stats[c] += (n))
+#else
+#define STATS_INC(th, c) ((void)0)
+#define STATS_ADD(th, c, n) ((void)0)
+#endif
+
+
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
@@ -46,8 +72,12 @@ class Thread {
   ConditionVariable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
+  bool clearing = false, cleared = false;
+  std::function<void()> job; // Run instead of a search, see start_job()
   std::thread stdThread;
 
+  void clear_continuation_history();
+
 public:
   explicit Thread(size_t);
   virtual ~Thread();
@@ -55,15 +85,21 @@ public:
   void clear();
   void idle_loop();
   void start_searching();
+  void start_clearing();
+  void start_job(std::function<void()> f);
   void wait_for_search_finished();
 
   Pawns::Table pawnsTable;
   Material::Table materialTable;
-  Endgames endgames;
+  Eval::Cache evalCache;
+  bool useEvalCache = false;
+  HashTable<Search::ZugzwangEntry, 4096> zugzwangTable;
   size_t pvIdx, pvLast, multiPV;
   int selDepth, nmpMinPly, zugzwangMates;
+  uint64_t zugzwangNodes;
   Color nmpColor;
-  std::atomic<uint64_t> nodes, tbHits;
+  std::atomic<uint64_t> nodes, tbHits, ttHits, tbCacheProbes, tbCacheHits;
+  uint64_t stats[STAT_NB] = {}; // Reset by clear(), see StatCounter
 
   Position rootPos;
   Search::RootMoves rootMoves;
@@ -71,7 +107,11 @@ public:
   CounterMoveHistory counterMoves;
   ButterflyHistory mainHistory;
   CapturePieceToHistory captureHistory;
+#if defined(CONTHIST_SHARED)
+  static ContinuationHistory continuationHistory; // Written by all the threads
+#else
   ContinuationHistory continuationHistory;
+#endif
   Score contempt;
 };
 
@@ -87,7 +127,13 @@ struct MainThread : public Thread {
 
   double bestMoveChanges, previousTimeReduction;
   Value previousScore;
+  Depth previousDepth; // Depth of the last search, as expected for the next one
   int callsCnt;
+  Thread* bestThread; // Thread whose result was reported by the last search
+  TimePoint lastPvOutput;  // Time of the last PV lines sent during the search
+  std::vector<Key> pvSent; // Signatures of these lines, see UCI::pv()
+  Mutex rootOrderMutex;
+  std::vector<Move> rootOrder; // First moves of the MultiPV lines, for the helpers
 };
 
 
@@ -100,12 +146,19 @@ struct ThreadPool : public std::vector<Thread*> {
   void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
   void clear();
   void set(size_t);
+  void wait_for_main();
+  void abandon() { std::vector<Thread*>::clear(); } // In a child made by fork(), see match.cpp
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  uint64_t tt_hits()        const { return accumulate(&Thread::ttHits); }
+  uint64_t tb_cache_probes() const { return accumulate(&Thread::tbCacheProbes); }
+  uint64_t tb_cache_hits()  const { return accumulate(&Thread::tbCacheHits); }
+  std::string stats() const;
 
   std::atomic_bool stop, ponder, stopOnPonderhit;
+  std::atomic_bool stopPrefetch; // Set while the main thread is waited for
 
 private:
   StateListPtr setupStates;
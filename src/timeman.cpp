@@ -36,6 +36,10 @@ namespace {
   constexpr double MaxRatio   = 7.3;  // When in trouble, we can step over reserved time with this ratio
   constexpr double StealRatio = 0.34; // However we must not steal time from remaining moves over this ratio
 
+  constexpr double KnownTimeRatio = 0.5; // Part of the optimum time used on a position fully covered by the TT
+  constexpr int    CoverPlies     = 6;    // A TT entry this many plies deeper than the expected depth covers all
+  constexpr Depth  DefaultDepth   = 24 * ONE_PLY; // Expected depth when there is no previous search
+
 
   // move_importance() is a skew-logistic function based on naive statistical
   // analysis of "how many games are still undecided after n half-moves". Game
@@ -130,4 +134,47 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
 
   if (Options["Ponder"])
       optimumTime += optimumTime / 4;
+
+  // The credit is never more than a small part of what is left on the clock
+  credit = std::min(credit, std::max(limits.time[us], TimePoint(0)) / 8);
+}
+
+
+/// adjust() scales the optimum time down when the TT entry of the root position
+/// is deeper than the search is expected to get, which is the depth of the last
+/// one. Such entries mostly come from a loaded hash file or an EPD import. The
+/// time saved goes to the credit, and a quarter of the credit is added to the
+/// time of each position that is not covered.
+
+void TimeManagement::adjust(Depth ttDepth, Bound ttBound, Depth expected) {
+
+  if (expected <= DEPTH_ZERO)
+      expected = DefaultDepth;
+
+  double coverage = ttBound == BOUND_NONE ? 0.0
+                  : double(ttDepth - expected) / (CoverPlies * ONE_PLY);
+
+  coverage = std::max(0.0, std::min(1.0, coverage)) * (ttBound == BOUND_EXACT ? 1.0 : 0.5);
+
+  if (coverage > 0)
+  {
+      TimePoint saved = TimePoint(optimumTime * coverage * (1 - KnownTimeRatio));
+      optimumTime -= saved;
+      credit += saved;
+  }
+  else
+  {
+      TimePoint bonus = std::min(credit / 4, std::max(maximumTime - optimumTime, TimePoint(0)));
+      optimumTime += bonus;
+      credit -= bonus;
+  }
+}
+
+
+/// book_move() adds the optimum time of a move played from the book to the
+/// credit, to be spent on the first positions out of the book.
+
+void TimeManagement::book_move() {
+
+  credit += optimumTime;
 }
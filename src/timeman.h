@@ -31,12 +31,15 @@
 class TimeManagement {
 public:
   void init(Search::LimitsType& limits, Color us, int ply);
+  void adjust(Depth ttDepth, Bound ttBound, Depth expected);
+  void book_move();
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
   TimePoint elapsed() const { return Search::Limits.npmsec ?
                                      TimePoint(Threads.nodes_searched()) : now() - startTime; }
 
   int64_t availableNodes; // When in 'nodes as time' mode
+  TimePoint credit;       // Time saved on known positions, for the next unknown ones
 
 private:
   TimePoint startTime;
@@ -18,10 +18,18 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>   // For std::memset
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <fstream>
+#include <iomanip>
+#include <unordered_set>
 #include "uci.h"
 using std::string;
 #include <sstream>
@@ -29,6 +37,7 @@ using std::string;
 #include <sstream>
 #include <vector>
 #include <iterator>
+#include "movegen.h"
 #include "position.h"
 #include "thread.h"
 #include "bitboard.h"
@@ -38,7 +47,13 @@ using std::string;
 #include "uci.h"
 
 
-#ifdef _WIN32
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#else
 #include "windows.h"
 #include <windows.h>
 #undef max
@@ -120,26 +135,93 @@ void Try_Get_LockMemory_Privileges()
 }
 #endif
 
+namespace {
+
+  // Hash files start with this header, followed by the clusters. Files from
+  // older versions have no header: they are raw dumps of the table and are
+  // still accepted by load(), sizing the table from the file length.
+  struct HashFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t clusterSize;
+    uint64_t clusterCount;
+    uint64_t checksum;
+    uint8_t  generation;
+    uint8_t  keyBits;     // TTEntry::KeyBits, zero in files of 16 bit builds
+    uint8_t  padding[30];
+  };
+
+  static_assert(sizeof(HashFileHeader) == 64, "HashFileHeader size incorrect");
+
+  const char HashFileMagic[8] = { 'S', 'u', 'g', 'a', 'R', 'T', 'T', '\0' };
+  constexpr uint32_t HashFileVersion = 2;
+
+  // PositionRecord is one entry of a binary position file: the magic below
+  // followed by the records in the byte order of the machine, as for the hash
+  // file. The full key makes it independent of the size of the table the
+  // positions come from or go to.
+  struct PositionRecord {
+    uint64_t key;
+    uint16_t move;
+    int16_t  value;
+    int16_t  eval;
+    int8_t   depth;
+    uint8_t  bound;
+  };
+
+  static_assert(sizeof(PositionRecord) == 16, "PositionRecord size incorrect");
+
+  const char PositionFileMagic[8] = { 'S', 'u', 'g', 'a', 'R', 'P', 'F', '\0' };
+
+  // Files are read and written in chunks, both to bound the memory used for
+  // checksumming on load and because some stream libraries do not handle a
+  // single transfer bigger than 2 GB.
+  constexpr size_t IOChunkSize = 16 * 1024 * 1024;
+
+  // same_layout() checks that the entries of a file are laid out like ours
+  bool same_layout(const HashFileHeader& h, size_t clusterSize) {
+
+    return   h.version == HashFileVersion
+          && h.clusterSize == clusterSize
+          && (h.keyBits ? h.keyBits : 16) == TTEntry::KeyBits;
+  }
+
+  bool read_header(std::ifstream& file, HashFileHeader& h) {
+
+    file.read(reinterpret_cast<char*>(&h), sizeof(h));
+    return file.good() && !std::memcmp(h.magic, HashFileMagic, sizeof(HashFileMagic));
+  }
+
+} // namespace
+
+
 /// TTEntry::save saves a TTEntry
 void TTEntry::save(Key k, Value v, Bound b, Depth d, Move m, Value ev) {
 
   assert(d / ONE_PLY * ONE_PLY == d);
 
+  TT.mark_dirty(this);
+
+  TTData e;
+  KeyCheck kc = read(e);
+
   // Preserve any existing move for the same position
-  if (m || (k >> 48) != key16)
-      move16 = (uint16_t)m;
+  if (m || key_check(k) != kc)
+      e.move16 = (uint16_t)m;
 
   // Overwrite less valuable entries
-  if (  (k >> 48) != key16
-      || d / ONE_PLY > depth8 - 4
+  if (  key_check(k) != kc
+      || d / ONE_PLY > e.depth8 - 4
       || b == BOUND_EXACT)
   {
-      key16     = (uint16_t)(k >> 48);
-      value16   = (int16_t)v;
-      eval16    = (int16_t)ev;
-      genBound8 = (uint8_t)(TT.generation8 | b);
-      depth8    = (int8_t)(d / ONE_PLY);
+      kc          = key_check(k);
+      e.value16   = (int16_t)v;
+      e.eval16    = (int16_t)ev;
+      e.genBound8 = (uint8_t)(TT.generation8 | b);
+      e.depth8    = (int8_t)(d / ONE_PLY);
   }
+
+  write(kc, e);
 }
 
 
@@ -157,14 +239,24 @@ void TranspositionTable::resize(size_t mbSize) {
 
   mbSize_last_used = mbSize;
 
+  wait_for_load();
+
 #ifdef _WIN32
   Try_Get_LockMemory_Privileges();
 #endif
 
   size_t newClusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
-
-  if (newClusterCount == clusterCount)
+  bool mapFile = Options["HashFileMapped"];
+  int allocFlags =  (Options["Large Pages"] ? LargePagesRequested : 0)
+                  | (Options["HashNUMA"] == "Interleave" ? InterleaveRequested : 0);
+
+  if (   newClusterCount == clusterCount
+      && mapFile == fileMapped
+      && (!fileMapped || mappedName == hashfilename)
+      && (fileMapped || allocFlags == lastAllocFlags))
   {
+      if (fileMapped)
+          return;
 #ifdef _WIN32
       if ((use_large_pages == 1) && (large_pages_used))      
           return;
@@ -174,23 +266,38 @@ void TranspositionTable::resize(size_t mbSize) {
   }
 
   clusterCount = newClusterCount;
+
+  if (mapFile)
+  {
+      free_mem();
+
+      if (map_hash_file())
+      {
+          table = (Cluster*)((char*)mem + sizeof(HashFileHeader));
+          mark_all_dirty();
+          return;
+      }
+
+      sync_cout << "info string Could not map " << hashfilename
+                << ", using process memory for the hash" << sync_endl;
+  }
  
 #ifdef _WIN32
   if (use_large_pages < 1)
 #endif
   {
-      if (mem != NULL)
-      {
-#ifdef _WIN32
-          if (large_pages_used)
-              VirtualFree(mem, 0, MEM_RELEASE);
-          else
-#endif
-              free(mem);
-      }
+      free_mem();
+
+#if defined(__linux__)
+      if (allocFlags & LargePagesRequested)
+          mem = alloc_huge_pages(clusterCount * sizeof(Cluster));
 
+      if (!mem)
+#endif
+      {
       size_t memsize = clusterCount * sizeof(Cluster) + CacheLineSize - 1;
       mem = calloc(memsize, 1);
+      }
 #ifdef _WIN32
       large_pages_used = false;
 #endif
@@ -198,13 +305,7 @@ void TranspositionTable::resize(size_t mbSize) {
 #ifdef _WIN32
   else
   {
-      if (mem != NULL)
-      {
-          if (large_pages_used)
-              VirtualFree(mem, 0, MEM_RELEASE);
-          else
-              free(mem);
-      }
+      free_mem();
 
       size_t memsize = clusterCount * sizeof(Cluster);
       mem = VirtualAlloc(NULL, memsize, MEM_LARGE_PAGES | MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
@@ -235,6 +336,247 @@ void TranspositionTable::resize(size_t mbSize) {
   }
 
   table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+  mark_all_dirty();
+  lastAllocFlags = allocFlags;
+
+#if defined(__linux__)
+  // Memory policy must be set before the pages are touched for the first time
+  int nodes = (allocFlags & InterleaveRequested) ? interleave(table, clusterCount * sizeof(Cluster)) : 0;
+
+  if (nodes > 1 || hugeAlloc != NoHugePages)
+      sync_cout << "info string Hash " << (clusterCount * sizeof(Cluster) >> 20) << " MB"
+                << (hugeAlloc == TransparentHugePages ? ", transparent huge pages"
+                  : hugeAlloc == HugeTLBPages         ? ", hugetlbfs pages" : "")
+                << (nodes > 1 ? ", interleaved over " + std::to_string(nodes) + " NUMA nodes" : "")
+                << sync_endl;
+
+  // Unlike calloc() memory, huge pages are not known to be zeroed. Clearing
+  // from all the search threads also places the pages on their NUMA nodes
+  // under the default first-touch policy.
+  if (hugeAlloc == TransparentHugePages)
+      clear();
+#endif
+}
+
+
+#if defined(__linux__)
+
+/// TranspositionTable::alloc_huge_pages() allocates the table on a 2 MB boundary
+/// and asks the kernel to back it with transparent huge pages, which greatly
+/// reduces TLB misses in probe(). If THP are not available the pages are
+/// taken from the hugetlbfs pool. Returns nullptr if both fail.
+
+void* TranspositionTable::alloc_huge_pages(size_t size) {
+
+  constexpr size_t HugePageSize = 2 * 1024 * 1024;
+  void* p = nullptr;
+
+  size = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+
+  if (!posix_memalign(&p, HugePageSize, size))
+  {
+      if (!madvise(p, size, MADV_HUGEPAGE))
+          return hugeAlloc = TransparentHugePages, p;
+
+      free(p);
+  }
+
+  p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  if (p == MAP_FAILED)
+      return nullptr;
+
+  hugeAllocSize = size;
+  return hugeAlloc = HugeTLBPages, p;
+}
+
+
+/// TranspositionTable::interleave() spreads the pages of the given range
+/// round-robin over all the online NUMA nodes, so that on multi-socket
+/// machines probes are served evenly by every memory controller instead of
+/// by the node of the thread that happened to touch the table first. Returns
+/// the number of nodes used. The raw system call is used to avoid a link
+/// dependency on libnuma.
+
+int TranspositionTable::interleave(void* addr, size_t size) {
+
+  constexpr int MpolInterleave = 3; // MPOL_INTERLEAVE from <numaif.h>
+  constexpr size_t PageSize = 4096;
+
+  unsigned long mask[16] = {};
+  const unsigned long maxNode = sizeof(mask) * 8;
+  int nodes = 0;
+
+  for (int n : sysfs_ids("/sys/devices/system/node/online"))
+      if (size_t(n) < maxNode)
+          mask[n / (8 * sizeof(unsigned long))] |= 1UL << (n % (8 * sizeof(unsigned long))), nodes++;
+
+  if (nodes < 2)
+      return nodes;
+
+  // mbind() wants a page aligned address
+  uintptr_t start = (uintptr_t(addr) + PageSize - 1) & ~(PageSize - 1);
+  uintptr_t end = (uintptr_t(addr) + size) & ~(PageSize - 1);
+
+  if (end <= start || syscall(SYS_mbind, start, end - start, MpolInterleave, mask, maxNode, 0))
+      return 0;
+
+  return nodes;
+}
+
+#endif
+
+
+/// TranspositionTable::free_mem() releases the memory of the table, however
+/// it was obtained.
+
+void TranspositionTable::free_mem() {
+
+  if (!mem)
+      return;
+
+  if (fileMapped)
+  {
+      HashFileHeader* h = (HashFileHeader*)mem;
+      h->generation = generation8;
+
+#ifndef _WIN32
+      munmap(mem, sizeof(HashFileHeader) + clusterCount * sizeof(Cluster));
+#else
+      UnmapViewOfFile(mem);
+      CloseHandle((HANDLE)mapping);
+#endif
+      fileMapped = false;
+  }
+#ifdef _WIN32
+  else if (large_pages_used)
+      VirtualFree(mem, 0, MEM_RELEASE);
+#endif
+#if defined(__linux__)
+  else if (hugeAlloc == HugeTLBPages)
+      munmap(mem, hugeAllocSize);
+#endif
+  else
+      free(mem);
+
+  mem = nullptr;
+#if defined(__linux__)
+  hugeAlloc = NoHugePages;
+#endif
+}
+
+
+/// TranspositionTable::map_hash_file() maps hashfilename, in the format written
+/// by save(), as shared read-write memory holding the table. When the file
+/// already holds a table of the current size its entries are kept, otherwise
+/// the file is recreated empty. The hash then persists across restarts without
+/// any explicit save or load, and processes mapping the same file share it.
+/// Note that clear() zeroes the file too, so NeverClearHash should be set.
+
+bool TranspositionTable::map_hash_file() {
+
+  const uint64_t size = sizeof(HashFileHeader) + uint64_t(clusterCount) * sizeof(Cluster);
+  HashFileHeader h;
+  bool compatible = false;
+
+#ifndef _WIN32
+  int fd = ::open(hashfilename.c_str(), O_RDWR | O_CREAT, 0644);
+
+  if (fd == -1)
+      return false;
+
+  struct stat statbuf;
+  fstat(fd, &statbuf);
+
+  compatible =   uint64_t(statbuf.st_size) == size
+              && pread(fd, &h, sizeof(h), 0) == ssize_t(sizeof(h))
+              && !std::memcmp(h.magic, HashFileMagic, sizeof(HashFileMagic))
+              && same_layout(h, sizeof(Cluster))
+              && h.clusterCount == clusterCount;
+
+  // Truncating first makes the new file a zero filled sparse one
+  if (!compatible && (ftruncate(fd, 0) || ftruncate(fd, off_t(size))))
+  {
+      ::close(fd);
+      return false;
+  }
+
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (base == MAP_FAILED)
+      return false;
+#else
+  HANDLE fd = CreateFile(hashfilename.c_str(), GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                         OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+  if (fd == INVALID_HANDLE_VALUE)
+      return false;
+
+  LARGE_INTEGER fileSize;
+  DWORD bytesRead = 0;
+
+  compatible =   GetFileSizeEx(fd, &fileSize)
+              && uint64_t(fileSize.QuadPart) == size
+              && ReadFile(fd, &h, sizeof(h), &bytesRead, nullptr)
+              && bytesRead == sizeof(h)
+              && !std::memcmp(h.magic, HashFileMagic, sizeof(HashFileMagic))
+              && same_layout(h, sizeof(Cluster))
+              && h.clusterCount == clusterCount;
+
+  // Growing the file with CreateFileMapping() fills it with zeros
+  if (!compatible)
+  {
+      LARGE_INTEGER zero;
+      zero.QuadPart = 0;
+      SetFilePointerEx(fd, zero, nullptr, FILE_BEGIN);
+      SetEndOfFile(fd);
+  }
+
+  HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_READWRITE,
+                                  DWORD(size >> 32), DWORD(size & 0xFFFFFFFF), nullptr);
+  CloseHandle(fd);
+
+  if (!mmap)
+      return false;
+
+  void* base = MapViewOfFile(mmap, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+  if (!base)
+  {
+      CloseHandle(mmap);
+      return false;
+  }
+
+  mapping = (uint64_t)mmap;
+#endif
+
+  HashFileHeader* header = (HashFileHeader*)base;
+
+  if (compatible)
+      generation8 = header->generation;
+  else
+  {
+      std::memcpy(header->magic, HashFileMagic, sizeof(HashFileMagic));
+      header->version = HashFileVersion;
+      header->clusterSize = sizeof(Cluster);
+      header->keyBits = TTEntry::KeyBits;
+      header->clusterCount = clusterCount;
+      header->generation = generation8;
+  }
+
+  // Entries change all the time, so the checksum is not maintained
+  header->checksum = 0;
+
+  mem = base;
+  fileMapped = true;
+  mappedName = hashfilename;
+
+  sync_cout << "info string Hash mapped to " << hashfilename
+            << (compatible ? ", entries kept" : ", new file") << sync_endl;
+
+  return true;
 }
 
 
@@ -243,6 +585,8 @@ void TranspositionTable::resize(size_t mbSize) {
 
 void TranspositionTable::clear() {
 
+  wait_for_load();
+
   std::vector<std::thread> threads;
 
   for (size_t idx = 0; idx < size_t(Options["Threads"]); idx++)
@@ -259,7 +603,106 @@ void TranspositionTable::clear() {
                        len    = idx != size_t(Options["Threads"]) - 1 ?
                                 stride : clusterCount - start;
 
-          std::memset(&table[start], 0, len * sizeof(Cluster));
+          std::memset(static_cast<void*>(&table[start]), 0, len * sizeof(Cluster));
+      }));
+  }
+
+  for (std::thread& th: threads)
+      th.join();
+
+  mark_all_dirty();
+}
+
+void TranspositionTable::set_hash_file_name(const std::string& fname) {
+
+  hashfilename = fname;
+
+  // The blocks saved so far are not in the new file, the next save is a full one
+  mark_all_dirty();
+
+  if (fileMapped)
+      resize(0);
+}
+
+
+/// TranspositionTable::mark_all_dirty() flags all the blocks of the table, so
+/// that the next save writes the whole table. Reallocates the flags when the
+/// table size changes, which is never during a search.
+
+void TranspositionTable::mark_all_dirty() {
+
+  if (dirtyBlocks != blocks())
+  {
+      dirtyBlocks = blocks();
+      dirty.reset(new std::atomic<uint8_t>[dirtyBlocks]);
+  }
+
+  for (size_t b = 0; b < dirtyBlocks; ++b)
+      dirty[b].store(1, std::memory_order_relaxed);
+}
+
+
+/// TranspositionTable::track_dirty() switches the tracking of the blocks
+/// written by the search, used by HashSaveDirtyOnly. The blocks written while
+/// it was off are unknown, so they are all flagged when it is switched on.
+
+void TranspositionTable::track_dirty(bool on) {
+
+  if (on && !trackDirty)
+      mark_all_dirty();
+
+  trackDirty = on;
+}
+
+
+
+/// TranspositionTable::checksum() hashes 'count' clusters, the first of which
+/// is cluster number 'first' in the table. The result is a sum of independent
+/// per-cluster terms, so stripes can be checksummed in parallel and added up.
+
+uint64_t TranspositionTable::checksum(const Cluster* c, size_t first, size_t count) {
+
+  static_assert(sizeof(Cluster) % sizeof(uint64_t) == 0, "Cluster not made of 64-bit words");
+
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; ++i)
+  {
+      uint64_t w[sizeof(Cluster) / sizeof(uint64_t)];
+      std::memcpy(w, &c[i], sizeof(Cluster));
+
+      uint64_t h = (first + i + 1) * 0x9E3779B97F4A7C15ULL;
+      for (uint64_t x : w)
+          h = (h ^ x) * 0x100000001B3ULL, h ^= h >> 29;
+
+      sum += h;
+  }
+
+  return sum;
+}
+
+
+/// TranspositionTable::for_each_stripe() calls f(firstBlock, lastBlock) from
+/// as many threads as there are search threads, splitting the dirty blocks
+/// of the table evenly among them, as clear() does with the clusters.
+
+void TranspositionTable::for_each_stripe(const std::function<void(size_t, size_t)>& f) const {
+
+  std::vector<std::thread> threads;
+  const size_t threadCount = std::max(size_t(1), std::min(size_t(Options["Threads"]), blocks()));
+
+  for (size_t idx = 0; idx < threadCount; idx++)
+  {
+      threads.push_back(std::thread([&f, idx, threadCount, this]() {
+
+          if (threadCount >= 8)
+              WinProcGroup::bindThisThread(idx);
+
+          const size_t stride = blocks() / threadCount,
+                       start  = stride * idx,
+                       end    = idx != threadCount - 1 ? start + stride : blocks();
+
+          f(start, end);
       }));
   }
 
@@ -267,36 +710,258 @@ void TranspositionTable::clear() {
       th.join();
 }
 
-void TranspositionTable::set_hash_file_name(const std::string& fname) { hashfilename = fname; }
+
+/// TranspositionTable::save() writes the table to hashfilename, preceded by a
+/// header recording its size, generation and checksum. Each search thread
+/// writes its own stripe of the file. When HashSaveDirtyOnly is set and the
+/// file holds a table of the same size, only the blocks of clusters written
+/// since the last save or load are rewritten.
 
 bool TranspositionTable::save() {
-	std::ofstream b_stream(hashfilename,
-		std::fstream::out | std::fstream::binary);
-	if (b_stream)
-	{
-		//b_stream.write(reinterpret_cast<char const *>(table), clusterCount * sizeof(Cluster));
-		for (unsigned long long i = 0; i < clusterCount * sizeof(Cluster); i += (1 << 30)) { //1GB
-#ifndef __min
-        #define __min(a,b) (((a) < (b)) ? (a) : (b))
+
+  wait_for_load();
+
+  // A mapped table is the hash file, just make sure it is written to disk
+  if (fileMapped)
+  {
+      const size_t size = sizeof(HashFileHeader) + clusterCount * sizeof(Cluster);
+      ((HashFileHeader*)mem)->generation = generation8;
+#ifndef _WIN32
+      bool ok = !msync(mem, size, MS_SYNC);
+#else
+      bool ok = FlushViewOfFile(mem, size);
 #endif
-		    unsigned long long j = __min((1 << 30), (clusterCount * sizeof(Cluster)) - i);
-			b_stream.write(reinterpret_cast<char const *>(table) + i, j);
-		}
-		return (b_stream.good());
-	}
-	return false;
+      sync_cout << "info string Hash " << (ok ? "flushed to " : "could not be flushed to ")
+                << hashfilename << sync_endl;
+      return ok;
+  }
+
+  HashFileHeader h;
+
+  {
+      std::ifstream file(hashfilename, std::ios::in | std::ios::binary);
+      bool incremental =   Options["HashSaveDirtyOnly"]
+                        && read_header(file, h)
+                        && same_layout(h, sizeof(Cluster))
+                        && h.clusterCount == clusterCount;
+      if (!incremental)
+          mark_all_dirty();
+  }
+
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, HashFileMagic, sizeof(HashFileMagic));
+  h.version = HashFileVersion;
+  h.clusterSize = sizeof(Cluster);
+  h.keyBits = TTEntry::KeyBits;
+  h.clusterCount = clusterCount;
+  h.generation = generation8;
+
+  // Create the file, or just open it if it is going to be updated in place
+  bool full = true;
+  for (size_t b = 0; b < dirtyBlocks; ++b)
+      full = full && dirty[b].load(std::memory_order_relaxed);
+
+  if (full)
+  {
+      std::ofstream file(hashfilename, std::ios::out | std::ios::binary | std::ios::trunc);
+      file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+      if (!file.good())
+          return false;
+  }
+
+  std::vector<uint64_t> sums(blocks());
+  std::atomic<bool> ok(true);
+  std::atomic<size_t> written(0);
+
+  for_each_stripe([&](size_t start, size_t end) {
+
+      std::fstream file(hashfilename, std::ios::in | std::ios::out | std::ios::binary);
+
+      for (size_t b = start; b < end && file.good(); ++b)
+      {
+          const size_t first = b << DirtyBlockShift;
+          const size_t count = std::min(size_t(DirtyBlockSize), clusterCount - first);
+
+          sums[b] = checksum(&table[first], first, count);
+
+          if (!dirty[b].load(std::memory_order_relaxed))
+              continue;
+
+          // Clear the flag before writing, an entry stored meanwhile will be
+          // saved next time.
+          dirty[b].store(0, std::memory_order_relaxed);
+          file.seekp(sizeof(h) + first * sizeof(Cluster));
+          file.write(reinterpret_cast<const char*>(&table[first]), count * sizeof(Cluster));
+          written += count;
+      }
+
+      if (!file.good())
+          ok = false;
+  });
+
+  for (uint64_t sum : sums)
+      h.checksum += sum;
+
+  std::fstream file(hashfilename, std::ios::in | std::ios::out | std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+  if (!file.good() || !ok)
+  {
+      mark_all_dirty();
+      sync_cout << "info string Could not save hash to " << hashfilename << sync_endl;
+      return false;
+  }
+
+  sync_cout << "info string Hash saved to " << hashfilename << ": "
+            << (written * sizeof(Cluster) >> 20) << " of "
+            << (clusterCount * sizeof(Cluster) >> 20) << " MB written" << sync_endl;
+
+  return true;
 }
 
+
+/// TranspositionTable::load_stripes() reads the clusters stored in the hash
+/// file from the given offset on into the table, in parallel stripes, and
+/// verifies them against the checksum in the file header. Each chunk is read
+/// into a private buffer and checksummed before being copied, so that the
+/// verification is not disturbed by a search running during an async load.
+/// The blocks of a chunk are flagged clean just before it is copied, so that
+/// entries stored afterwards by the search are saved next time.
+
+bool TranspositionTable::load_stripes(size_t offset, uint64_t expected) {
+
+  std::vector<uint64_t> sums(blocks());
+  std::atomic<bool> ok(true);
+
+  for_each_stripe([&](size_t start, size_t end) {
+
+      std::ifstream file(hashfilename, std::ios::in | std::ios::binary);
+      std::vector<Cluster> buffer(IOChunkSize / sizeof(Cluster));
+      const size_t chunkBlocks = buffer.size() >> DirtyBlockShift;
+
+      file.seekg(offset + (start << DirtyBlockShift) * sizeof(Cluster));
+
+      for (size_t b = start; b < end && file.good(); b += chunkBlocks)
+      {
+          const size_t first = b << DirtyBlockShift;
+          const size_t count = std::min(std::min(end, b + chunkBlocks) << DirtyBlockShift,
+                                        clusterCount) - first;
+
+          if (!file.read(reinterpret_cast<char*>(buffer.data()), count * sizeof(Cluster)))
+              break;
+
+          sums[b] = checksum(buffer.data(), first, count);
+
+          for (size_t k = b; k < std::min(end, b + chunkBlocks); ++k)
+              dirty[k].store(0, std::memory_order_relaxed);
+
+          std::memcpy(static_cast<void*>(&table[first]), buffer.data(), count * sizeof(Cluster));
+      }
+
+      if (!file.good())
+          ok = false;
+  });
+
+  uint64_t sum = 0;
+  for (uint64_t s : sums)
+      sum += s;
+
+  return ok && (!expected || sum == expected);
+}
+
+
+/// TranspositionTable::load() resizes the table to the one stored in the hash
+/// file and reads it back. With HashLoadAsync the clusters are streamed in by
+/// background threads and the engine can search meanwhile: each chunk of
+/// clusters is copied whole over the table as it arrives, so the entries the
+/// search stored in those clusters before are lost, while the ones it stores
+/// afterwards are kept.
+
 void TranspositionTable::load() {
-	//file size: https://stackoverflow.com/questions/2409504/using-c-filestreams-fstream-how-can-you-determine-the-size-of-a-file
-	std::ifstream file;
-	file.open(hashfilename, std::ios::in | std::ios::binary);
-	file.ignore(std::numeric_limits<std::streamsize>::max());
-	std::streamsize size = file.gcount();
-	file.clear();   //  Since ignore will have set eof.
-	resize(size_t(size / 1024 / 1024));
-	file.seekg(0, std::ios::beg);
-	file.read(reinterpret_cast<char *>(table), clusterCount * sizeof(Cluster));
+
+  wait_for_load();
+
+  if (fileMapped && mappedName == hashfilename)
+  {
+      sync_cout << "info string Hash is mapped to " << hashfilename << ", nothing to load" << sync_endl;
+      return;
+  }
+
+  HashFileHeader h;
+  size_t offset = sizeof(h);
+  std::ifstream file(hashfilename, std::ios::in | std::ios::binary);
+
+  if (!file.is_open())
+  {
+      sync_cout << "info string Could not open " << hashfilename << sync_endl;
+      return;
+  }
+
+  if (read_header(file, h))
+  {
+      if (!same_layout(h, sizeof(Cluster)))
+      {
+          sync_cout << "info string Unsupported hash file " << hashfilename << sync_endl;
+          return;
+      }
+
+      resize(size_t(h.clusterCount * sizeof(Cluster) >> 20));
+  }
+  else if (TTEntry::KeyBits != 16)
+  {
+      sync_cout << "info string Unsupported hash file " << hashfilename << sync_endl;
+      return;
+  }
+  else
+  {
+      // Headerless dump of a previous version, see HashFileHeader
+      //file size: https://stackoverflow.com/questions/2409504/using-c-filestreams-fstream-how-can-you-determine-the-size-of-a-file
+      file.clear();
+      file.seekg(0, std::ios::beg);
+      file.ignore(std::numeric_limits<std::streamsize>::max());
+      std::streamsize size = file.gcount();
+
+      resize(size_t(size / 1024 / 1024));
+      offset = 0;
+      h.checksum = 0;
+      h.clusterCount = clusterCount;
+      h.generation = generation8;
+  }
+
+  file.close();
+
+  if (h.clusterCount != clusterCount)
+  {
+      sync_cout << "info string Hash file size does not match the Hash option" << sync_endl;
+      return;
+  }
+
+  generation8 = h.generation;
+
+  auto job = [this, offset, h]() {
+
+      TimePoint elapsed = now();
+      bool ok = load_stripes(offset, h.checksum);
+
+      sync_cout << "info string Hash loaded from " << hashfilename << " in "
+                << now() - elapsed << " ms" << (ok ? "" : ", checksum mismatch") << sync_endl;
+  };
+
+  if (Options["HashLoadAsync"])
+      loader = std::thread(job);
+  else
+      job();
+}
+
+
+/// TranspositionTable::wait_for_load() blocks until a background load started
+/// by load() has completed. It must be called before reallocating, clearing or
+/// saving the table.
+
+void TranspositionTable::wait_for_load() {
+
+  if (loader.joinable())
+      loader.join();
 }
 
 enum { SAN_MOVE_NORMAL, SAN_PAWN_CAPTURE };
@@ -542,68 +1207,331 @@ Value uci_to_score(std::string &str)
 	return v;
 }
 
+namespace {
+
+  constexpr size_t ImportBatchSize = 1024;
+  constexpr uint64_t ImportProgressStep = 100000;
+
+  // import_epd() extracts the position, depth (acd), best move (bm) and score
+  // (ce) of an EPD record like "<fen> acd 20; bm Nf3; ce 35;" and stores them
+  // into the TT. The best move can be given either in SAN or in UCI notation,
+  // the latter skips the slower SAN resolution. Returns false if the line is not
+  // a valid record.
+
+  bool import_epd(const std::string& line, Position& pos, StateInfo& st) {
+
+    std::vector<std::string> x = split(line, ';');
+    std::size_t i;
+
+    if (x.empty() || (i = x[0].find("acd")) == std::string::npos)
+        return false;
+
+    pos.set(x[0].substr(0, i), Options["UCI_Chess960"], &st, Threads.main());
+
+    int depth = std::atoi(x[0].c_str() + i + 4);
+    Move bm = MOVE_NONE;
+    Value ce = VALUE_NONE;
+
+    for (std::vector<std::string>::size_type j = 1; j < x.size(); j++)
+    {
+        if (bm == MOVE_NONE && (i = x[j].find("bm ")) == 1)
+        {
+            std::string stri = x[j].substr(i + 3);
+            bool coordinate =   stri.size() >= 4
+                             && stri[0] >= 'a' && stri[0] <= 'h' && stri[1] >= '1' && stri[1] <= '8'
+                             && stri[2] >= 'a' && stri[2] <= 'h' && stri[3] >= '1' && stri[3] <= '8';
+
+            bm = coordinate ? UCI::to_move(pos, stri) : san_to_move(pos, stri);
+        }
+        else if (ce == VALUE_NONE && (i = x[j].find("ce ")) == 1)
+        {
+            std::string stri = x[j].substr(i + 3);
+            ce = uci_to_score(stri);
+        }
+    }
+
+    bool ttHit;
+    TTEntry* tte = TT.probe(pos.key(), ttHit);
+
+    // Without a score only the move is of use
+    tte->save(pos.key(), ce, ce != VALUE_NONE ? BOUND_EXACT : BOUND_NONE,
+              Depth(depth * ONE_PLY), bm, VALUE_NONE);
+
+    return true;
+  }
+
+  // run_import() is a two stage pipeline: the calling thread reads batches of
+  // records with produce() while one worker per search thread consumes them.
+  // consume() returns the number of records it could store. Progress is
+  // reported every ImportProgressStep records.
+
+  template<typename Record>
+  void run_import(const std::string& name,
+                  const std::function<bool(std::vector<Record>&)>& produce,
+                  const std::function<size_t(std::vector<Record>&)>& consume) {
+
+    const size_t workerCount = std::max(size_t(1), size_t(Options["Threads"]));
+    std::deque<std::vector<Record>> queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<uint64_t> stored(0);
+    uint64_t read = 0, nextReport = ImportProgressStep;
+    bool done = false;
+    TimePoint elapsed = now();
+
+    std::vector<std::thread> workers;
+
+    for (size_t idx = 0; idx < workerCount; idx++)
+        workers.push_back(std::thread([&]() {
+
+            std::vector<Record> batch;
+
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lk(mutex);
+                    cv.wait(lk, [&]{ return done || !queue.empty(); });
+
+                    if (queue.empty())
+                        return;
+
+                    batch = std::move(queue.front());
+                    queue.pop_front();
+                }
+                cv.notify_all(); // Wake up the reader if it waits for room
+
+                stored += consume(batch);
+            }
+        }));
+
+    std::vector<Record> batch;
+
+    while (produce(batch))
+    {
+        read += batch.size();
+
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            cv.wait(lk, [&]{ return queue.size() < 4 * workerCount; });
+            queue.push_back(std::move(batch));
+        }
+        cv.notify_all();
+
+        batch.clear();
+
+        if (read >= nextReport)
+        {
+            sync_cout << "info string " << name << ": " << read << " positions read" << sync_endl;
+            nextReport += ImportProgressStep;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        done = true;
+    }
+    cv.notify_all();
+
+    for (std::thread& th : workers)
+        th.join();
+
+    sync_cout << "info string " << name << ": " << stored << " of " << read
+              << " positions stored in " << now() - elapsed << " ms" << sync_endl;
+  }
+
+} // namespace
+
+
+/// TranspositionTable::load_epd_to_hash() imports the analysis in hashfilename
+/// into the TT. The file is either an EPD file, see import_epd(), or a binary
+/// file of PositionRecord entries. Records are parsed and stored by all the
+/// search threads, and with HashLoadAsync the import runs in the background.
+
 void TranspositionTable::load_epd_to_hash() {
-	std::string line;
-	std::ifstream myfile(hashfilename);
-	Position pos;
-	Move bm;
-	int ce;
-	int depth;
-	generation8 = 4; //for storing the positions
-
-	if (myfile.is_open())
-	{
-		while (getline(myfile, line))
-		{
-			std::vector<std::string> x = split(line, ';');
-
-			//extract and set position
-			std::size_t i = x[0].find("acd"); //depth searched. Is after the fen string
-			StateListPtr states(new std::deque<StateInfo>(1));
-			sync_cout << x[0].substr(0, i) << sync_endl;
-			pos.set(x[0].substr(0, i), Options["UCI_Chess960"], &states->back(), Threads.main());
-			
-			//depth
-			depth = std::stoi(x[0].substr(i + 4));
-			sync_cout << depth << sync_endl;
-
-			bm = MOVE_NONE;
-			ce = -1000000;
-
-			for (std::vector<int>::size_type j = 1; j <= x.size(); j++) {
-				if (bm == MOVE_NONE) {
-					i = x[j].find("bm ");
-					if (i == 1) {
-						sync_cout << x[j].substr(i + 3) << sync_endl;
-						std::string stri = x[j].substr(i + 3);
-						bm = san_to_move(pos, stri);
-						if (bm != MOVE_NONE)
-							sync_cout << "move ok" << sync_endl;
-						continue;
-					}
-				}
-				if (ce == -1000000) {
-					i = x[j].find("ce ");
-					if (i == 1) {
-						std::string stri = x[j].substr(i + 3);
-						ce = uci_to_score(stri);
-						sync_cout << "ce " << ce << sync_endl;
-						continue;
-					}
-				}
-			}
 
-			TTEntry* tte;
-			bool ttHit;
-			tte = TT.probe(pos.key(), ttHit);
+  wait_for_load();
 
-			tte->save(pos.key(), (Value)ce, BOUND_EXACT, (Depth)depth,
-				bm, VALUE_NONE);
-		}
-		myfile.close();
-	}
+  std::shared_ptr<std::ifstream> file = std::make_shared<std::ifstream>(hashfilename, std::ios::in | std::ios::binary);
+
+  if (!file->is_open())
+  {
+      sync_cout << "info string Could not open " << hashfilename << sync_endl;
+      return;
+  }
+
+  char magic[sizeof(PositionFileMagic)] = {};
+  file->read(magic, sizeof(magic));
+  bool binary = file->good() && !std::memcmp(magic, PositionFileMagic, sizeof(magic));
+
+  if (!binary)
+      file->clear(), file->seekg(0, std::ios::beg);
+
+  generation8 = 4; //for storing the positions
+
+  auto job = [file, binary]() {
+
+      if (binary)
+          run_import<PositionRecord>("Position import",
+              [file](std::vector<PositionRecord>& batch) {
+                  batch.resize(ImportBatchSize);
+                  file->read(reinterpret_cast<char*>(batch.data()), batch.size() * sizeof(PositionRecord));
+                  batch.resize(size_t(file->gcount()) / sizeof(PositionRecord));
+                  return !batch.empty();
+              },
+              [](std::vector<PositionRecord>& batch) {
+                  for (const PositionRecord& r : batch)
+                  {
+                      bool ttHit;
+                      TT.probe(r.key, ttHit)->save(r.key, Value(r.value), Bound(r.bound & 0x3),
+                                                   Depth(r.depth * ONE_PLY), Move(r.move), Value(r.eval));
+                  }
+                  return batch.size();
+              });
+      else
+          run_import<std::string>("EPD import",
+              [file](std::vector<std::string>& batch) {
+                  std::string line;
+                  while (batch.size() < ImportBatchSize && std::getline(*file, line))
+                      if (!line.empty())
+                          batch.push_back(line);
+                  return !batch.empty();
+              },
+              [](std::vector<std::string>& batch) {
+                  Position pos;
+                  StateInfo st;
+                  size_t cnt = 0;
+                  for (const std::string& line : batch)
+                      cnt += import_epd(line, pos, st);
+                  return cnt;
+              });
+  };
+
+  if (Options["HashLoadAsync"])
+      loader = std::thread(job);
+  else
+      job();
+}
+
+namespace {
+
+  // score_to_ce() is the inverse of uci_to_score(), used for the ce field
+  int score_to_ce(Value v) {
+
+    return  v >=  VALUE_MATE_IN_MAX_PLY ?  32767 - (VALUE_MATE - v)
+          : v <= -VALUE_MATE_IN_MAX_PLY ? -32767 + (VALUE_MATE + v)
+          : int(v) * 100 / int(PawnValueMg);
+  }
+
+  // export_tree() walks the part of the game tree below pos that is stored in
+  // the TT with at least minDepth, hash move first so that the principal
+  // variation is written before its siblings. The TT only keeps 16 bits of
+  // the key, the full one comes from the position reached.
+
+  void export_tree(Position& pos, int ply, int minDepth, std::unordered_set<Key>& visited,
+                   const std::function<void(const Position&, const TTEntry*)>& write) {
+
+    bool ttHit;
+    const TTEntry* tte = TT.probe(pos.key(), ttHit);
+
+    if (   !ttHit
+        || tte->depth() < minDepth * ONE_PLY
+        || !visited.insert(pos.key()).second)
+        return;
+
+    write(pos, tte);
+
+    if (ply >= MAX_PLY - 1)
+        return;
+
+    Move ttMove = tte->move();
+    StateInfo st;
+
+    if (ttMove != MOVE_NONE && pos.pseudo_legal(ttMove) && pos.legal(ttMove))
+    {
+        pos.do_move(ttMove, st);
+        export_tree(pos, ply + 1, minDepth, visited, write);
+        pos.undo_move(ttMove);
+    }
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+        if (m != ttMove)
+        {
+            pos.do_move(m, st);
+            export_tree(pos, ply + 1, minDepth, visited, write);
+            pos.undo_move(m);
+        }
+  }
+
+} // namespace
+
+
+/// TranspositionTable::export_positions() writes the entries reachable from pos
+/// with at least minDepth to fname. Files ending in ".epd" get EPD records as
+/// read by load_epd_to_hash(), other names a binary file of PositionRecord
+/// entries. Both hold full keys, so they can be loaded into a table of any size.
+
+void TranspositionTable::export_positions(Position& pos, const std::string& fname, int minDepth) {
+
+  wait_for_load();
+
+  bool epd = fname.size() > 4 && fname.compare(fname.size() - 4, 4, ".epd") == 0;
+  std::ofstream file(fname, std::ios::out | std::ios::binary | std::ios::trunc);
+
+  if (!file.is_open())
+  {
+      sync_cout << "info string Could not open " << fname << sync_endl;
+      return;
+  }
+
+  std::unordered_set<Key> visited;
+  TimePoint elapsed = now();
+
+  if (!epd)
+      file.write(PositionFileMagic, sizeof(PositionFileMagic));
+
+  export_tree(pos, 0, minDepth, visited, [&](const Position& p, const TTEntry* tte) {
+
+      if (epd)
+      {
+          std::string fen = p.fen();
+          fen.erase(fen.find_last_of(' ', fen.find_last_of(' ') - 1)); // Drop move counters
+
+          file << fen << " acd " << tte->depth() / ONE_PLY << ";";
+
+          if (tte->move() != MOVE_NONE)
+              file << " bm " << UCI::move(tte->move(), p.is_chess960()) << ";";
+
+          if (tte->bound() == BOUND_EXACT && tte->value() != VALUE_NONE)
+              file << " ce " << score_to_ce(tte->value()) << ";";
+
+          file << "\n";
+      }
+      else
+      {
+          PositionRecord r = { p.key(), uint16_t(tte->move()), int16_t(tte->value()),
+                               int16_t(tte->eval()), int8_t(tte->depth() / ONE_PLY),
+                               uint8_t(tte->bound()) };
+          file.write(reinterpret_cast<const char*>(&r), sizeof(r));
+      }
+  });
+
+  file.close();
+
+  sync_cout << "info string Exported " << visited.size() << " positions to " << fname
+            << " in " << now() - elapsed << " ms" << sync_endl;
+}
+
+/// TranspositionTable::prefetch() issues together the prefetches of the clusters
+/// of the positions reached by a batch of moves, so that their cache misses
+/// overlap with each other and with the search of the first ones.
+
+void TranspositionTable::prefetch(const Position& pos, const ExtMove* begin, const ExtMove* end) const {
+
+  for (const ExtMove* m = begin; m < end; ++m)
+      ::prefetch(first_entry(pos.key_after(m->move)));
 }
 
+
 /// TranspositionTable::probe() looks up the current position in the transposition
 /// table. It returns true and a pointer to the TTEntry if the position is found.
 /// Otherwise, it returns false and a pointer to an empty or least valuable TTEntry
@@ -614,28 +1542,65 @@ void TranspositionTable::load_epd_to_hash() {
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
   TTEntry* const tte = first_entry(key);
-  const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
+  const TTEntry::KeyCheck keyCheck = TTEntry::key_check(key);  // Use the high bits as key inside the cluster
+
+  TTData d[ClusterSize];
 
   for (size_t i = 0; i < ClusterSize; ++i)
-      if (!tte[i].key16 || tte[i].key16 == key16)
-      {
-          tte[i].genBound8 = uint8_t(generation8 | tte[i].bound()); // Refresh
+  {
+      const TTEntry::KeyCheck kc = tte[i].read(d[i]);
 
-          return found = (bool)tte[i].key16, &tte[i];
+      if (!kc || kc == keyCheck)
+      {
+          if ((d[i].genBound8 & 0xFC) != generation8)
+          {
+              d[i].genBound8 = uint8_t(generation8 | (d[i].genBound8 & 0x3)); // Refresh
+              tte[i].write(kc, d[i]);
+              mark_dirty(&tte[i]);
+          }
+
+          return found = (bool)kc, &tte[i];
       }
+  }
 
   // Find an entry to be replaced according to the replacement strategy
-  TTEntry* replace = tte;
+  size_t replace = 0;
   for (size_t i = 1; i < ClusterSize; ++i)
       // Due to our packed storage format for generation and its cyclic
       // nature we add 259 (256 is the modulus plus 3 to keep the lowest
       // two bound bits from affecting the result) to calculate the entry
       // age correctly even after generation8 overflows into the next cycle.
-      if (  replace->depth8 - ((259 + generation8 - replace->genBound8) & 0xFC) * 2
-          >   tte[i].depth8 - ((259 + generation8 -   tte[i].genBound8) & 0xFC) * 2)
-          replace = &tte[i];
+      if (  d[replace].depth8 - ((259 + generation8 - d[replace].genBound8) & 0xFC) * 2
+          >       d[i].depth8 - ((259 + generation8 -       d[i].genBound8) & 0xFC) * 2)
+          replace = i;
+
+  return found = false, &tte[replace];
+}
+
+
+/// TranspositionTable::torn_entries() counts the entries of the cluster of the
+/// given key that were torn by concurrent writes. With the full key stored the
+/// key of a sound entry selects its own cluster, while a torn one decodes to
+/// noise. Tearing can't be detected with partial key checks, 0 is returned.
+
+int TranspositionTable::torn_entries(const Key key) const {
+
+  int cnt = 0;
+
+#if defined(TT_KEY64)
+  const TTEntry* tte = first_entry(key);
+  TTData d;
+
+  for (size_t i = 0; i < ClusterSize; ++i)
+  {
+      const Key k = tte[i].read(d);
+      cnt += k && first_entry(k) != tte;
+  }
+#else
+  (void)key;
+#endif
 
-  return found = false, replace;
+  return cnt;
 }
 
 
@@ -649,8 +1614,120 @@ int TranspositionTable::hashfull() const {
   {
       const TTEntry* tte = &table[i].entry[0];
       for (size_t j = 0; j < ClusterSize; j++)
-          if ((tte[j].genBound8 & 0xFC) == generation8)
+          if ((tte[j].data().genBound8 & 0xFC) == generation8)
               cnt++;
   }
   return cnt;
 }
+
+
+/// TranspositionTable::stats() scans the whole table with one thread per search
+/// thread and returns its exact occupancy with the depth, age and bound mix of
+/// the entries. A cluster whose entries are all from the current search can
+/// only make room by dropping one of them, the share of such clusters tells
+/// how much the table is under pressure.
+
+std::string TranspositionTable::stats() {
+
+  wait_for_load();
+
+  constexpr int AgeBuckets = 7, DepthBuckets = 9;
+
+  struct Counts {
+    uint64_t used = 0, current = 0, fullClusters = 0, pressedClusters = 0;
+    uint64_t bound[4] = {}, age[AgeBuckets] = {}, depth[DepthBuckets] = {};
+  };
+
+  std::vector<Counts> partial;
+  std::mutex mutex;
+  std::atomic<size_t> blocksDone(0);
+  const size_t reportStep = std::max(blocks() / 10, size_t(1));
+  const bool report = clusterCount * sizeof(Cluster) >= (size_t(1) << 30);
+
+  for_each_stripe([&](size_t start, size_t end) {
+
+      Counts c;
+
+      for (size_t b = start; b < end; ++b)
+      {
+          const size_t last = std::min((b + 1) << DirtyBlockShift, clusterCount);
+
+          for (size_t i = b << DirtyBlockShift; i < last; ++i)
+          {
+              int used = 0, current = 0;
+
+              for (const TTEntry& tte : table[i].entry)
+              {
+                  TTData d;
+
+                  if (!tte.read(d))
+                      continue;
+
+                  int age = ((259 + generation8 - d.genBound8) & 0xFC) / 4;
+
+                  used++;
+                  current += !age;
+                  c.bound[d.genBound8 & 0x3]++;
+                  c.age[age < 4 ? age : age < 8 ? 4 : age < 16 ? 5 : 6]++;
+                  c.depth[d.depth8 < 1 ? 0 : std::min((d.depth8 - 1) / 8 + 1, DepthBuckets - 1)]++;
+              }
+
+              c.used += used;
+              c.current += current;
+              c.fullClusters += used == int(ClusterSize);
+              c.pressedClusters += current == int(ClusterSize);
+          }
+
+          size_t done = ++blocksDone;
+          if (report && done % reportStep == 0)
+              sync_cout << "info string ttstats " << done * 100 / blocks() << "% scanned" << sync_endl;
+      }
+
+      std::lock_guard<std::mutex> lk(mutex);
+      partial.push_back(c);
+  });
+
+  Counts t;
+  for (const Counts& c : partial)
+  {
+      t.used += c.used, t.current += c.current;
+      t.fullClusters += c.fullClusters, t.pressedClusters += c.pressedClusters;
+      for (int i = 0; i < 4; ++i) t.bound[i] += c.bound[i];
+      for (int i = 0; i < AgeBuckets; ++i) t.age[i] += c.age[i];
+      for (int i = 0; i < DepthBuckets; ++i) t.depth[i] += c.depth[i];
+  }
+
+  const uint64_t entries = uint64_t(clusterCount) * ClusterSize;
+  auto pct = [](uint64_t n, uint64_t total) {
+      std::stringstream ss;
+      ss << std::fixed << std::setprecision(2) << (total ? 100.0 * n / total : 0.0) << "%";
+      return ss.str();
+  };
+
+  std::stringstream ss;
+
+  ss << "Entries   : " << entries << " in " << clusterCount << " clusters of " << ClusterSize
+     << ", " << TTEntry::KeyBits << " bit keys"
+     << "\nUsed      : " << t.used << " (" << pct(t.used, entries) << ")"
+     << "\nCurrent   : " << t.current << " (" << pct(t.current, entries) << ", hashfull "
+     << hashfull() << " sampled)"
+     << "\nFull      : " << pct(t.fullClusters, clusterCount) << " of clusters"
+     << "\nPressure  : " << pct(t.pressedClusters, clusterCount) << " of clusters hold only current entries"
+     << "\nBound     : none " << pct(t.bound[BOUND_NONE], t.used)
+     << " upper " << pct(t.bound[BOUND_UPPER], t.used)
+     << " lower " << pct(t.bound[BOUND_LOWER], t.used)
+     << " exact " << pct(t.bound[BOUND_EXACT], t.used);
+
+  const char* ageLabels[AgeBuckets] = { "0", "1", "2", "3", "4-7", "8-15", "16-63" };
+
+  ss << "\nAge       :";
+  for (int i = 0; i < AgeBuckets; ++i)
+      ss << " " << ageLabels[i] << ":" << pct(t.age[i], t.used);
+
+  ss << "\nDepth     : <1:" << pct(t.depth[0], t.used);
+  for (int i = 1; i < DepthBuckets; ++i)
+      ss << " " << (i - 1) * 8 + 1 << (i < DepthBuckets - 1 ? "-" + std::to_string(i * 8) : "+")
+         << ":" << pct(t.depth[i], t.used);
+
+  return ss.str();
+}
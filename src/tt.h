@@ -21,9 +21,20 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "misc.h"
 #include "types.h"
 
+class Position;
+struct ExtMove;
+
 /// TTEntry struct is the 10 bytes transposition table entry, defined as below:
 ///
 /// key        16 bit
@@ -33,25 +44,84 @@
 /// generation  6 bit
 /// bound type  2 bit
 /// depth       8 bit
+///
+/// Building with ttkey=32 (TT_KEY32) verifies 32 instead of 16 key bits, which
+/// makes false hits rare even with huge, long lived tables. The entry grows to
+/// 12 bytes and a cluster to 5 entries in a whole cache line.
+///
+/// Building with ttkey=64 (TT_KEY64) stores the full key xored with the other
+/// fields, each in a 64-bit word written with a single atomic store. An entry
+/// torn by concurrent writes of two threads no longer matches its key and is
+/// seen as a miss. The entry grows to 16 bytes and a cluster to 4 entries.
+
+struct TTData {
+  uint16_t move16;
+  int16_t  value16;
+  int16_t  eval16;
+  uint8_t  genBound8;
+  int8_t   depth8;
+};
 
 struct TTEntry {
 
-  Move  move()  const { return (Move )move16; }
-  Value value() const { return (Value)value16; }
-  Value eval()  const { return (Value)eval16; }
-  Depth depth() const { return (Depth)(depth8 * int(ONE_PLY)); }
-  Bound bound() const { return (Bound)(genBound8 & 0x3); }
+  Move  move()  const { return (Move )data().move16; }
+  Value value() const { return (Value)data().value16; }
+  Value eval()  const { return (Value)data().eval16; }
+  Depth depth() const { return (Depth)(data().depth8 * int(ONE_PLY)); }
+  Bound bound() const { return (Bound)(data().genBound8 & 0x3); }
   void save(Key k, Value v, Bound b, Depth d, Move m, Value ev);
 
+#if defined(TT_KEY64)
+  typedef uint64_t KeyCheck;
+#elif defined(TT_KEY32)
+  typedef uint32_t KeyCheck;
+#else
+  typedef uint16_t KeyCheck;
+#endif
+
+  // The check is taken from the high bits, the low ones select the cluster
+  static constexpr int KeyBits = 8 * sizeof(KeyCheck);
+  static KeyCheck key_check(Key k) { return KeyCheck(k >> (64 - KeyBits)); }
+
 private:
   friend class TranspositionTable;
 
-  uint16_t key16;
-  uint16_t move16;
-  int16_t  value16;
-  int16_t  eval16;
-  uint8_t  genBound8;
-  int8_t   depth8;
+  // read() returns the key check and the data of one snapshot of the entry,
+  // write() replaces both. A zero key check marks an empty entry.
+#if defined(TT_KEY64)
+  static_assert(sizeof(TTData) == sizeof(uint64_t), "TTData size incorrect");
+
+  TTData data() const { return unpack(data64.load(std::memory_order_relaxed)); }
+
+  KeyCheck read(TTData& out) const {
+    uint64_t w = data64.load(std::memory_order_relaxed);
+    out = unpack(w);
+    return key64.load(std::memory_order_relaxed) ^ w;
+  }
+
+  void write(KeyCheck k, const TTData& in) {
+    uint64_t w;
+    std::memcpy(&w, &in, sizeof(w));
+    key64.store(k ^ w, std::memory_order_relaxed);
+    data64.store(w, std::memory_order_relaxed);
+  }
+
+  static TTData unpack(uint64_t w) {
+    TTData d;
+    std::memcpy(&d, &w, sizeof(d));
+    return d;
+  }
+
+  std::atomic<uint64_t> key64;
+  std::atomic<uint64_t> data64;
+#else
+  TTData data() const { return fields; }
+  KeyCheck read(TTData& out) const { out = fields; return keyCheck; }
+  void write(KeyCheck k, const TTData& in) { keyCheck = k; fields = in; }
+
+  KeyCheck keyCheck;
+  TTData   fields;
+#endif
 };
 
 
@@ -65,29 +135,47 @@ private:
 class TranspositionTable {
 
   static constexpr size_t CacheLineSize = 64;
+#if defined(TT_KEY64)
+  static constexpr size_t ClusterSize = 4;
+#elif defined(TT_KEY32)
+  static constexpr size_t ClusterSize = 5;
+#else
   static constexpr size_t ClusterSize = 3;
+#endif
 
   struct Cluster {
     TTEntry entry[ClusterSize];
-    char padding[2]; // Align to a divisor of the cache line size
+#if !defined(TT_KEY64)
+    char padding[TTEntry::KeyBits / 8]; // Align to a divisor of the cache line size
+#endif
   };
 
   static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
 
+  // Clusters are tracked for incremental saving in blocks of 2048 (64 KB)
+  static constexpr size_t DirtyBlockShift = 11;
+  static constexpr size_t DirtyBlockSize = size_t(1) << DirtyBlockShift;
+
 public:
   TranspositionTable() { mbSize_last_used = 0;  mbSize_last_used = 0; }
-  ~TranspositionTable() {}
+  ~TranspositionTable() { wait_for_load(); free_mem(); }
   void new_search() { generation8 += 4; } // Lower 2 bits are used by Bound
   void infinite_search() { generation8 = 4; }
   uint8_t generation() const { return generation8; }
   TTEntry* probe(const Key key, bool& found) const;
+  int torn_entries(const Key key) const;
+  void prefetch(const Position& pos, const ExtMove* begin, const ExtMove* end) const;
   int hashfull() const;
+  std::string stats();
   void resize(size_t mbSize);
   void clear();
   void set_hash_file_name(const std::string& fname);
+  void track_dirty(bool on);
   bool save();
   void load();
+  void wait_for_load();
   void load_epd_to_hash();
+  void export_positions(Position& pos, const std::string& fname, int minDepth);
   std::string hashfilename = "hash.hsh";
 
   // The 32 lowest order bits of the key are used to get the index of the cluster
@@ -98,12 +186,50 @@ public:
 private:
   friend struct TTEntry;
 
+  size_t blocks() const { return (clusterCount + DirtyBlockSize - 1) >> DirtyBlockShift; }
+  void mark_dirty(const TTEntry* tte) const {
+    if (!trackDirty.load(std::memory_order_relaxed))
+        return;
+
+    // Test first, so that the flag's cache line is shared while it is set
+    std::atomic<uint8_t>& d = dirty[(uintptr_t(tte) - uintptr_t(table)) / sizeof(Cluster) >> DirtyBlockShift];
+    if (!d.load(std::memory_order_relaxed))
+        d.store(1, std::memory_order_relaxed);
+  }
+  void mark_all_dirty();
+  enum { LargePagesRequested = 1, InterleaveRequested = 2 };
+  enum HugeAlloc { NoHugePages, TransparentHugePages, HugeTLBPages };
+
+  void free_mem();
+#if defined(__linux__)
+  void* alloc_huge_pages(size_t size);
+  int interleave(void* addr, size_t size);
+#endif
+  bool map_hash_file();
+  void for_each_stripe(const std::function<void(size_t, size_t)>& f) const;
+  bool load_stripes(size_t offset, uint64_t checksum);
+  static uint64_t checksum(const Cluster* c, size_t first, size_t count);
+
   size_t  mbSize_last_used;
+  std::unique_ptr<std::atomic<uint8_t>[]> dirty; // One flag per block, set when an entry changes
+  size_t dirtyBlocks = 0;
+  std::atomic<bool> trackDirty; // Flags are kept only with HashSaveDirtyOnly
+  std::thread loader;         // Background reader of LoadHashfromFile
 
 #ifdef _WIN32
   bool large_pages_used;
 #endif
 
+#if defined(__linux__)
+  HugeAlloc hugeAlloc;
+  size_t hugeAllocSize;
+#endif
+
+  int lastAllocFlags;      // Large Pages and HashNUMA in use for the table
+  bool fileMapped;         // Table is a shared mapping of hashfilename
+  uint64_t mapping;        // Windows file mapping handle
+  std::string mappedName;
+
   size_t clusterCount;
   Cluster* table;
   void* mem;
@@ -37,6 +37,19 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_DISPATCH | Detect popcnt and pext support at startup and use them only
+///                | if present, so that a single x86 64-bit binary runs well on
+///                | any hardware. Not to be combined with USE_POPCNT/USE_PEXT.
+///
+/// -DUSE_AVX2    | Compute the slider attacks of the evaluation with AVX2 (and
+///               | AVX-512 if enabled too) instead of the attack tables.
+///
+/// -DATTACK_MAPS | Update the attacks of every piece incrementally in do_move()
+///               | and let the evaluation read them from the position.
+///
+/// -DCONTHIST_COMPACT, -DCONTHIST_TO, -DCONTHIST_SHARED | Alternative layouts
+///               | of the continuation history, see PieceToStats in movepick.h.
 
 #include <cassert>
 #include <cctype>
@@ -72,13 +85,25 @@
 #  include <xmmintrin.h> // Intel and Microsoft header for _mm_prefetch()
 #endif
 
-#if defined(USE_PEXT)
+#if defined(USE_PEXT) || (defined(USE_DISPATCH) && defined(_MSC_VER))
 #  include <immintrin.h> // Header for _pext_u64() intrinsic
 #  define pext(b, m) _pext_u64(b, m)
+#elif defined(USE_DISPATCH)
+// The instruction is emitted directly, the compiler flags do not enable BMI2
+inline uint64_t pext_asm(uint64_t b, uint64_t m) {
+  uint64_t r;
+  __asm__("pextq %2, %1, %0" : "=r" (r) : "r" (b), "r" (m));
+  return r;
+}
+#  define pext(b, m) pext_asm(b, m)
 #else
 #  define pext(b, m) 0
 #endif
 
+#if defined(USE_DISPATCH)
+extern bool HasPopCnt, HasPext; // Set by CPU::init() at startup
+#else
+
 #ifdef USE_POPCNT
 constexpr bool HasPopCnt = true;
 #else
@@ -91,6 +116,8 @@ constexpr bool HasPext = true;
 constexpr bool HasPext = false;
 #endif
 
+#endif
+
 #ifdef IS_64BIT
 constexpr bool Is64Bit = true;
 #else
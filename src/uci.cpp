@@ -19,12 +19,18 @@
 */
 
 #include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 
+#include "cluster.h"
 #include "evaluate.h"
+#include "match.h"
 #include "movegen.h"
+#include "polybook.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -36,6 +42,7 @@
 using namespace std;
 
 extern vector<string> setup_bench(const Position&, istream&);
+extern void move_bench(istream&);
 
 namespace {
 
@@ -102,18 +109,14 @@ namespace {
   }
 
 
-  // go() is called when engine receives the "go" UCI command. The function sets
-  // the thinking time and other parameters from the input string, then starts
-  // the search.
+  // parse_limits() reads the search limits of a "go" command from the input
+  // string. Returns true if the search is a ponder one.
 
-  void go(Position& pos, istringstream& is, StateListPtr& states) {
+  bool parse_limits(Position& pos, istringstream& is, Search::LimitsType& limits) {
 
-    Search::LimitsType limits;
     string token;
     bool ponderMode = false;
 
-    limits.startTime = now(); // As early as possible!
-
     while (is >> token)
         if (token == "searchmoves")
             while (is >> token)
@@ -132,24 +135,352 @@ namespace {
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
 
+    return ponderMode;
+  }
+
+
+  // go() is called when engine receives the "go" UCI command. The function sets
+  // the thinking time and other parameters from the input string, then starts
+  // the search.
+
+  void go(Position& pos, istringstream& is, StateListPtr& states) {
+
+    Search::LimitsType limits;
+
+    limits.startTime = now(); // As early as possible!
+
+    bool ponderMode = parse_limits(pos, is, limits);
+
     Threads.start_thinking(pos, states, limits, ponderMode);
   }
 
 
+  // analyse() is called when engine receives the "analyse" command. It then
+  // reads one job per line from stdin until "end" or EOF, and answers each
+  // one with a single "result" line. A job is a position as in the "position"
+  // command, or just a FEN, optionally followed by "go" and the limits of the
+  // search; jobs without limits use the ones given to "analyse". Engine output
+  // during the search is suppressed, and the book is not used, so that each
+  // result comes from a search. Jobs share the TT, each one being a new
+  // search generation, unless AnalyseClearHash is set.
+
+  void analyse(Position& pos, istringstream& args, StateListPtr& states) {
+
+    string line, defaults;
+    uint64_t id = 0;
+
+    getline(args, defaults);
+
+    while (getline(cin, line))
+    {
+        istringstream is(line);
+        string token, spec;
+
+        if (!(is >> token))
+            continue;
+
+        if (token == "end")
+            break;
+
+        if (token == "setoption")
+        {
+            setoption(is);
+            continue;
+        }
+
+        // Split the position part from the limits
+        size_t goPos = line.find(" go");
+        spec = line.substr(0, goPos);
+        istringstream limitsStream(goPos != string::npos ? line.substr(goPos + 3) : defaults);
+
+        if (token != "startpos" && token != "fen")
+            spec = "fen " + spec;
+
+        if (Options["AnalyseClearHash"])
+            Search::clear();
+
+        istringstream posStream(spec);
+        position(pos, posStream, states);
+
+        Search::LimitsType limits;
+        limits.startTime = now();
+        parse_limits(pos, limitsStream, limits);
+        limits.silent = true; // Also keeps the book out, see MainThread::search()
+        limits.infinite = 0;  // Nobody would stop it
+
+        if (!limits.depth && !limits.nodes && !limits.movetime && !limits.mate && !limits.time[pos.side_to_move()])
+            limits.depth = 1;
+
+        Threads.start_thinking(pos, states, limits);
+        Threads.main()->wait_for_search_finished();
+
+        const Thread* th = Threads.main()->bestThread;
+        const Search::RootMove& rm = th->rootMoves[0];
+        TimePoint elapsed = now() - limits.startTime;
+
+        stringstream ss;
+
+        ss << "result " << ++id
+           << " depth "    << th->completedDepth / ONE_PLY
+           << " seldepth " << rm.selDepth;
+
+        if (rm.pv[0] == MOVE_NONE)
+            ss << " score " << UCI::value(pos.checkers() ? -VALUE_MATE : VALUE_DRAW);
+        else
+            ss << " score " << UCI::value(rm.score);
+
+        ss << " nodes "    << Threads.nodes_searched()
+           << " time "     << elapsed
+           << " bestmove " << UCI::move(rm.pv[0], pos.is_chess960())
+           << " pv";
+
+        for (Move m : rm.pv)
+            ss << " " << UCI::move(m, pos.is_chess960());
+
+        sync_cout << ss.str() << sync_endl;
+    }
+  }
+
+
+  // BenchResult holds the statistics of one searched bench position
+
+  struct BenchResult {
+    int run, position, depth, selDepth;
+    uint64_t nodes, ttHits, tbHits;
+    TimePoint time;
+  };
+
+  // write_report() writes the per position results of bench() to a file
+
+  void write_report(const string& fname, const vector<BenchResult>& results,
+                    double npsMean, double npsDev) {
+
+    ofstream file(fname);
+    bool json = fname.size() > 5 && fname.compare(fname.size() - 5, 5, ".json") == 0;
+
+    if (!file.is_open())
+    {
+        cerr << "Unable to open file " << fname << endl;
+        return;
+    }
+
+    if (json)
+        file << "{\n  \"nps_mean\": " << uint64_t(npsMean)
+             << ",\n  \"nps_stddev\": " << uint64_t(npsDev)
+             << ",\n  \"positions\": [";
+    else
+        file << "run,position,nodes,time,nps,depth,seldepth,tthitrate,tbhits\n";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        uint64_t nps = 1000 * r.nodes / (r.time + 1);
+        double hitRate = r.nodes ? double(r.ttHits) / r.nodes : 0.0;
+
+        if (json)
+            file << (i ? "," : "") << "\n    { \"run\": " << r.run
+                 << ", \"position\": " << r.position
+                 << ", \"nodes\": " << r.nodes
+                 << ", \"time\": " << r.time
+                 << ", \"nps\": " << nps
+                 << ", \"depth\": " << r.depth
+                 << ", \"seldepth\": " << r.selDepth
+                 << ", \"tthitrate\": " << hitRate
+                 << ", \"tbhits\": " << r.tbHits << " }";
+        else
+            file << r.run << "," << r.position << "," << r.nodes << "," << r.time << ","
+                 << nps << "," << r.depth << "," << r.selDepth << "," << hitRate << ","
+                 << r.tbHits << "\n";
+    }
+
+    if (json)
+        file << "\n  ]\n}\n";
+  }
+
   // bench() is called when engine receives the "bench" command. Firstly
   // a list of UCI commands is setup according to bench parameters, then
-  // it is run one by one printing a summary at the end.
+  // it is run one by one printing a summary at the end. The bench parameters
+  // can be followed by "runs N" to repeat the list, reporting the mean and
+  // the deviation of the speed, and by "report <file>" to write the results
+  // of every position to a JSON file, or to a CSV one if the name does not
+  // end with ".json".
 
   void bench(Position& pos, istream& args, StateListPtr& states) {
 
-    string token;
+    string token, reportFile;
     uint64_t num, nodes = 0, cnt = 1;
+    int runs = 1;
+    vector<BenchResult> results;
+    vector<double> runNps;
 
     vector<string> list = setup_bench(pos, args);
     num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0; });
 
+    while (args >> token)
+        if (token == "runs")        args >> runs;
+        else if (token == "report") args >> reportFile;
+
+    runs = std::max(runs, 1);
+
     TimePoint elapsed = now();
 
+    for (int run = 1; run <= runs; ++run)
+    {
+        uint64_t runNodes = 0;
+        TimePoint runStart = now();
+
+        cnt = 1;
+
+        for (const auto& cmd : list)
+        {
+            istringstream is(cmd);
+            is >> skipws >> token;
+
+            if (token == "go")
+            {
+                cerr << "\nPosition: " << cnt << '/' << num;
+                if (runs > 1)
+                    cerr << " (run " << run << '/' << runs << ")";
+                cerr << endl;
+
+                TimePoint start = now();
+                go(pos, is, states);
+                Threads.main()->wait_for_search_finished();
+
+                const Thread* th = Threads.main()->bestThread;
+                BenchResult r = { run, int(cnt++), int(th->completedDepth / ONE_PLY),
+                                  th->rootMoves[0].selDepth, Threads.nodes_searched(),
+                                  Threads.tt_hits(), Threads.tb_hits(), now() - start };
+                results.push_back(r);
+                runNodes += r.nodes;
+            }
+            else if (token == "setoption")  setoption(is);
+            else if (token == "position")   position(pos, is, states);
+            else if (token == "ucinewgame") Search::clear();
+        }
+
+        nodes += runNodes;
+        runNps.push_back(1000.0 * runNodes / (now() - runStart + 1));
+    }
+
+    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+    double npsMean = 0, npsDev = 0;
+    for (double n : runNps)
+        npsMean += n / runs;
+    for (double n : runNps)
+        npsDev += (n - npsMean) * (n - npsMean) / runs;
+    npsDev = std::sqrt(npsDev);
+
+    dbg_print(); // Just before exiting
+
+#ifdef SEARCH_STATS
+    cerr << Threads.stats() << endl;
+#endif
+
+    cerr << "\n==========================="
+         << "\nTotal time (ms) : " << elapsed
+         << "\nNodes searched  : " << nodes
+         << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+
+    if (runs > 1)
+        cerr << "Runs            : " << runs
+             << "\nNodes/second    : " << uint64_t(npsMean) << " mean, "
+             << uint64_t(npsDev) << " stddev" << endl;
+
+    if (!reportFile.empty())
+        write_report(reportFile, results, npsMean, npsDev);
+  }
+
+  // smpbench() is called when engine receives the "smpbench" command. It
+  // searches the bench positions to a fixed depth with 1, 2, 4, ... up to
+  // maxThreads threads and reports for each count the time to depth, the
+  // speedup over one thread, the speed per thread and the TT hit rate, whose
+  // change with the thread count shows how much the threads share or fight
+  // over the table. Usage: smpbench [maxThreads] [ttSize] [depth]
+
+  void smpbench(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    int maxThreads;
+    if (!(args >> maxThreads))
+        maxThreads = int(Options["Threads"]);
+    string ttSize  = (args >> token) ? token : "64";
+    string depth   = (args >> token) ? token : "13";
+    TimePoint baseTime = 0;
+
+    vector<int> counts;
+    for (int n = 1; n < maxThreads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(std::max(maxThreads, 1));
+
+    cerr << "\nThreads   Time(ms)  Speedup        Nodes        NPS  NPS/thread  TTHit%" << endl;
+
+    for (int threads : counts)
+    {
+        istringstream benchArgs(ttSize + " " + std::to_string(threads) + " " + depth);
+        vector<string> list = setup_bench(pos, benchArgs);
+        uint64_t nodes = 0, ttHits = 0;
+        TimePoint elapsed = 0;
+
+        for (const auto& cmd : list)
+        {
+            istringstream is(cmd);
+            is >> skipws >> token;
+
+            if (token == "go")
+            {
+                Search::LimitsType limits;
+                limits.startTime = now();
+                parse_limits(pos, is, limits);
+                limits.silent = true;
+
+                Threads.start_thinking(pos, states, limits);
+                Threads.main()->wait_for_search_finished();
+
+                elapsed += now() - limits.startTime;
+                nodes += Threads.nodes_searched();
+                ttHits += Threads.tt_hits();
+            }
+            else if (token == "setoption")  setoption(is);
+            else if (token == "position")   position(pos, is, states);
+            else if (token == "ucinewgame") Search::clear();
+        }
+
+        elapsed = std::max(elapsed, TimePoint(1));
+
+        if (threads == 1)
+            baseTime = elapsed;
+
+        uint64_t nps = 1000 * nodes / elapsed;
+
+        cerr << std::setw(7)  << threads
+             << std::setw(11) << elapsed
+             << std::setw(9)  << std::fixed << std::setprecision(2) << (baseTime ? double(baseTime) / elapsed : 0.0)
+             << std::setw(13) << nodes
+             << std::setw(11) << nps
+             << std::setw(12) << nps / threads
+             << std::setw(8)  << std::setprecision(1) << (nodes ? 100.0 * ttHits / nodes : 0.0) << endl;
+    }
+  }
+
+  // histbench() is called when engine receives the "histbench" command. It
+  // searches the bench positions to a fixed depth, and reports the speed and
+  // the share of beta cutoffs produced by the first move, a measure of the
+  // move ordering, for the history layout of the build (see PieceToStats).
+  // Only CONTHIST_SHARED changes the search, and only with several threads:
+  // the other layouts search the same tree. Usage: histbench [threads] [depth]
+
+  void histbench(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    string threads = (args >> token) ? token : "1";
+    string depth   = (args >> token) ? token : "13";
+    istringstream benchArgs("16 " + threads + " " + depth);
+    vector<string> list = setup_bench(pos, benchArgs);
+    uint64_t nodes = 0;
+    TimePoint elapsed = 0;
+
     for (const auto& cmd : list)
     {
         istringstream is(cmd);
@@ -157,9 +488,15 @@ namespace {
 
         if (token == "go")
         {
-            cerr << "\nPosition: " << cnt++ << '/' << num << endl;
-            go(pos, is, states);
+            Search::LimitsType limits;
+            limits.startTime = now();
+            parse_limits(pos, is, limits);
+            limits.silent = true;
+
+            Threads.start_thinking(pos, states, limits);
             Threads.main()->wait_for_search_finished();
+
+            elapsed += now() - limits.startTime;
             nodes += Threads.nodes_searched();
         }
         else if (token == "setoption")  setoption(is);
@@ -167,14 +504,28 @@ namespace {
         else if (token == "ucinewgame") Search::clear();
     }
 
-    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
-
-    dbg_print(); // Just before exiting
+    elapsed = std::max(elapsed, TimePoint(1));
 
     cerr << "\n==========================="
+         << "\nContinuation    : " << ContinuationLayout << ", "
+         << sizeof(ContinuationHistory) / 1024 << " KB"
+         << "\nOther histories : " << (sizeof(ButterflyHistory) + sizeof(CapturePieceToHistory)
+                                      + sizeof(CounterMoveHistory)) / 1024 << " KB"
+         << "\nThreads         : " << threads
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+
+#ifdef SEARCH_STATS
+    uint64_t cutoffs = 0, first = 0;
+    for (Thread* th : Threads)
+        cutoffs += th->stats[STAT_CUTOFF], first += th->stats[STAT_CUTOFF_FIRST];
+
+    cerr << "Beta cutoffs    : " << cutoffs << ", first move " << std::fixed
+         << std::setprecision(1) << (cutoffs ? 100.0 * first / cutoffs : 0.0) << "%" << endl;
+#else
+    cerr << "Beta cutoffs    : build with stats=yes" << endl;
+#endif
   }
 
 } // namespace
@@ -207,6 +558,10 @@ void UCI::loop(int argc, char* argv[]) {
       token.clear(); // Avoid a stale if getline() returns empty or blank line
       is >> skipws >> token;
 
+      // A cluster worker runs only the commands of its master, see cluster.h
+      if (!Cluster::accepts(token))
+          continue;
+
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
       // user has played. We should continue searching but switch from pondering to
@@ -227,13 +582,60 @@ void UCI::loop(int argc, char* argv[]) {
 
       else if (token == "setoption")  setoption(is);
       else if (token == "go")         go(pos, is, states);
-      else if (token == "position")   position(pos, is, states);
-      else if (token == "ucinewgame") Search::clear();
+      else if (token == "position")   position(pos, is, states), Cluster::send(cmd);
+      else if (token == "ucinewgame") polybook.save_learning(), Search::clear(), Cluster::send(cmd);
       else if (token == "isready")    sync_cout << "readyok" << sync_endl;
 
       // Additional custom non-UCI commands, mainly for debugging
       else if (token == "flip")  pos.flip();
       else if (token == "bench") bench(pos, is, states);
+      else if (token == "analyse") analyse(pos, is, states);
+      else if (token == "smpbench") smpbench(pos, is, states);
+      else if (token == "movebench") move_bench(is);
+      else if (token == "histbench") histbench(pos, is, states);
+      else if (token == "tunematch") Match::run(is);
+      else if (token == "stats")    sync_cout << Threads.stats() << sync_endl;
+      else if (token == "startup")  sync_cout << Startup::report() << sync_endl;
+      else if (token == "ttput")    Cluster::receive(is);
+      else if (token == "clusterrank")
+      {
+          int rank;
+          if (is >> rank)
+              Cluster::set_rank(rank);
+      }
+      else if (token == "clusterworker")
+      {
+          // Serve a master from now on, also when started from the command line
+          string where = "7000", secret;
+          is >> where >> secret;
+          if (Cluster::listen(where, secret))
+              argc = 1;
+      }
+      else if (token == "bookbench")
+      {
+          int probes;
+          if (!(is >> probes))
+              probes = 1000000;
+          polybook.bench(std::max(probes, 1));
+      }
+      else if (token == "bookcompact")
+      {
+          string fname = (is >> token) ? token : string(Options["BookFile"]) + ".compact";
+          polybook.compact(fname);
+      }
+      else if (token == "ttstats")
+      {
+          string stats = TT.stats(); // Prints its progress, so not inside sync_cout
+          sync_cout << stats << sync_endl;
+      }
+      else if (token == "exporthash")
+      {
+          string fname = (is >> token) ? token : TT.hashfilename + ".bin";
+          int minDepth;
+          if (!(is >> minDepth))
+              minDepth = 1;
+          TT.export_positions(pos, fname, minDepth);
+      }
       else if (token == "d")     sync_cout << pos << sync_endl;
       else if (token == "eval")  sync_cout << Eval::trace(pos) << sync_endl;
       else
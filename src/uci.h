@@ -72,7 +72,8 @@ void loop(int argc, char* argv[]);
 std::string value(Value v);
 std::string square(Square s);
 std::string move(Move m, bool chess960);
-std::string pv(const Position& pos, Depth depth, Value alpha, Value beta);
+std::string pv(const Position& pos, Depth depth, Value alpha, Value beta,
+               std::vector<Key>* sent = nullptr);
 Move to_move(const Position& pos, std::string& str);
 
 } // namespace UCI
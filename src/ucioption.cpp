@@ -26,6 +26,7 @@
 //end_Hash
 #include <thread>
 
+#include "cluster.h"
 #include "misc.h"
 #include "position.h"
 #include "search.h"
@@ -44,20 +45,28 @@ namespace UCI {
 /// 'On change' actions, triggered by an option's value change
 void on_clear_hash(const Option&) { Search::clear(); }
 void on_hash_size(const Option& o) { TT.resize(o); }
-void on_large_pages(const Option& o) { TT.resize(o); }  // warning is ok, will be removed
+void on_large_pages(const Option&) { TT.resize(0); }
 void on_logger(const Option& o) { start_logger(o); }
 void on_threads(const Option& o) { Threads.set(o); }
+void on_shared_pawn_hash(const Option& o) { Pawns::SharedPawns.resize(o); }
+void on_eval_tables(const Option&) { Threads.clear(); }
 void on_tb_path(const Option& o) { Tablebases::init(o); }
+void on_tb_cache(const Option& o) { Tablebases::resize_cache(o); }
 //Hash	
 void on_HashFile(const Option& o) { TT.set_hash_file_name(o); }
 void SaveHashtoFile(const Option&) { TT.save(); }
 void LoadHashfromFile(const Option&) { TT.load(); }
 void LoadEpdToHash(const Option&) { TT.load_epd_to_hash(); }
+void on_hash_file_mapped(const Option&) { TT.resize(0); }
+void on_save_dirty_only(const Option& o) { TT.track_dirty(o); }
 //end_Hash
 
 void on_book_file(const Option& o) { polybook.init(o); }
 void on_best_book_move(const Option& o) { polybook.set_best_book_move(o); }
 void on_book_depth(const Option& o) { polybook.set_book_depth(o); }
+void on_book_index(const Option& o) { polybook.set_book_index(o); }
+void on_book_learning(const Option& o) { polybook.set_learning(o); }
+void on_cluster_workers(const Option& o) { Cluster::init(o, Options["ClusterSecret"]); }
 
 /// Our case insensitive less() function as required by UCI protocol
 bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const {
@@ -81,26 +90,42 @@ void init(OptionsMap& o) {
   o["Contempt"]              << Option(21, -100, 100);
   o["Analysis_CT"]           << Option("Both var Off var White var Black var Both", "Both");
   o["Threads"]               << Option(n, unsigned(1), unsigned(512), on_threads);
+  o["SMPSkipWrap"]           << Option(20, 1, 512);
+  o["ClusterSecret"]         << Option("<empty>");
+  o["ClusterWorkers"]        << Option("<empty>", on_cluster_workers);
+  o["PerftHash"]             << Option(64, 0, 16384);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+  o["SharedPawnHash"]        << Option(0, 0, 4096, on_shared_pawn_hash);
+  o["PawnTableSize"]         << Option(16384, 256, 1 << 22, on_eval_tables);
+  o["MaterialTableSize"]     << Option(8192, 256, 1 << 20, on_eval_tables);
+  o["EvalCacheSize"]         << Option(0, 0, 1 << 22, on_eval_tables);
   o["BookFile"]              << Option("Cerebellum_Light_Poly.bin", on_book_file);
   o["BestBookMove"]          << Option(true, on_best_book_move);
   o["BookDepth"]             << Option(255, 1, 255, on_book_depth);
+  o["BookIndex"]             << Option(false, on_book_index);
+  o["BookLearning"]          << Option(false, on_book_learning);
   o["Clear Hash"]            << Option(on_clear_hash);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
   o["UCI_Chess960"]          << Option(false);
   o["NeverClearHash"]        << Option(false);
   o["HashFile"]              << Option("hash.hsh", on_HashFile);
+  o["HashFileMapped"]        << Option(false, on_hash_file_mapped);
   o["SaveHashtoFile"]        << Option(SaveHashtoFile);
+  o["HashSaveDirtyOnly"]     << Option(false, on_save_dirty_only);
   o["LoadHashfromFile"]      << Option(LoadHashfromFile);
+  o["HashLoadAsync"]         << Option(false);
   o["LoadEpdToHash"]         << Option(LoadEpdToHash);
   o["UCI_AnalyseMode"]       << Option(false);
+  o["AnalyseClearHash"]      << Option(false);
   o["Large Pages"]           << Option(true, on_large_pages);
+  o["HashNUMA"]              << Option("FirstTouch var FirstTouch var Interleave", "FirstTouch", on_large_pages);
   o["ICCF Analyzes"]         << Option(0, 0,  8);
   o["NullMove"]              << Option(true);
   o["SyzygyPath"]            << Option("<empty>", on_tb_path);
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
+  o["SyzygyCache"]           << Option(16, 0, 4096, on_tb_cache);
 }
 
 